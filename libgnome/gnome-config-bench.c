@@ -0,0 +1,277 @@
+/* Benchmarks for the gnome-config engine, run by make check
+ *
+ * Synthetic layered files with 10 up to max_keys keys (100000, or the
+ * number given on the command line) are written to a scratch
+ * directory, which is removed again afterwards, and every measurement
+ * is printed as a tab separated line: benchmark, number of keys, value
+ * and unit.  Only the figures are reported, so the program fails only
+ * if it cannot run at all.
+ */
+
+#include <config.h>
+
+#undef GNOME_DISABLE_DEPRECATED
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "gnome-config.h"
+#include "gnome-program.h"
+#include "gnome-init.h"
+
+static char *bench_dir;
+static char *bench_home, *bench_sys, *bench_override;
+
+/* a value long enough to spill over a cache line or two */
+#define BENCH_LONG_VALUE \
+  "a long value with some spaces in it, escaped\\ or not, and " \
+  "enough of it that copying it around is not free for the " \
+  "engine: lorem ipsum dolor sit amet consectetur adipiscing"
+
+static void
+bench_report (const char *name, int n_keys, double value, const char *unit)
+{
+  printf ("%s\t%d\t%.1f\t%s\n", name, n_keys, value, unit);
+  fflush (stdout);
+}
+
+static char *
+bench_mkdir (const char *rel)
+{
+  char *dir = g_build_filename (bench_dir, rel, NULL);
+
+  g_mkdir_with_parents (dir, 0700);
+  return dir;
+}
+
+/*
+ * writes a file with n_keys keys spread over sections of about 100
+ * keys.  Every tenth key has a long value and every tenth (but one)
+ * has two translations.  Keys are included when i % every == 0.
+ */
+static void
+bench_write_file (const char *filename, int n_keys, int every,
+                  const char *tag)
+{
+  GString *text = g_string_new (NULL);
+  int n_sections = n_keys / 100 + 1;
+  int s, i;
+
+  for (s = 0; s < n_sections; s++)
+    {
+      g_string_append_printf (text, "[section%d]\n", s);
+      for (i = s; i < n_keys; i += n_sections)
+        {
+          if (i % every != 0)
+            continue;
+          g_string_append_printf (text, "key%d=%s%d %s\n", i, tag, i,
+                                  i % 10 == 0 ? BENCH_LONG_VALUE : "");
+          if (i % 10 == 1)
+            {
+              g_string_append_printf (text, "key%d[de]=%s%d de\n",
+                                      i, tag, i);
+              g_string_append_printf (text, "key%d[fr]=%s%d fr\n",
+                                      i, tag, i);
+            }
+        }
+    }
+
+  g_file_set_contents (filename, text->str, text->len, NULL);
+  g_string_free (text, TRUE);
+}
+
+/* removes path and everything below it */
+static void
+bench_remove (const char *path)
+{
+  const char *entry;
+  GDir *dir;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir != NULL)
+    {
+      while ((entry = g_dir_read_name (dir)) != NULL)
+        {
+          char *child = g_build_filename (path, entry, NULL);
+
+          bench_remove (child);
+          g_free (child);
+        }
+      g_dir_close (dir);
+      g_rmdir (path);
+    }
+  else
+    g_remove (path);
+}
+
+static double
+bench_ns_per (GTimer *timer, int n)
+{
+  return g_timer_elapsed (timer, NULL) * 1e9 / MAX (n, 1);
+}
+
+/* what the files gnome-config holds take, per key looked up in them */
+static double
+bench_bytes_per (int n)
+{
+  GnomeConfigCacheStats stats;
+
+  gnome_config_get_cache_stats (&stats);
+  return (double) stats.bytes / MAX (n, 1);
+}
+
+static void
+bench_keys (int n_keys)
+{
+  char *rel, *filename;
+  char **paths, **abs_paths;
+  int n_sections = n_keys / 100 + 1;
+  GTimer *timer = g_timer_new ();
+  int i;
+
+  rel = g_strdup_printf ("bench-%d", n_keys);
+
+  /* the defaults have every key, ~/.gnome2 a tenth, override 1% */
+  filename = g_build_filename (bench_sys, rel, NULL);
+  bench_write_file (filename, n_keys, 1, "default");
+  g_free (filename);
+  filename = g_build_filename (bench_override, rel, NULL);
+  bench_write_file (filename, n_keys, 100, "override");
+  g_free (filename);
+  filename = g_build_filename (bench_home, rel, NULL);
+  bench_write_file (filename, n_keys, 10, "user");
+
+  paths = g_new (char *, n_keys);
+  abs_paths = g_new (char *, n_keys);
+  for (i = 0; i < n_keys; i++)
+    {
+      paths[i] = g_strdup_printf ("/%s/section%d/key%d", rel,
+                                  i % n_sections, i);
+      abs_paths[i] = g_strdup_printf ("=%s=/section%d/key%d", filename,
+                                      i % n_sections, i);
+    }
+
+  /* parsing and indexing the file, on the first lookup */
+  gnome_config_drop_all ();
+  g_timer_start (timer);
+  g_free (gnome_config_get_string (abs_paths[0]));
+  g_timer_stop (timer);
+  bench_report ("load", n_keys, bench_ns_per (timer, n_keys / 10),
+                "ns/key");
+  bench_report ("memory-load", n_keys, bench_bytes_per (n_keys / 10),
+                "bytes/key");
+
+  /* single file lookups, loading it on the first one */
+  gnome_config_drop_all ();
+  g_timer_start (timer);
+  for (i = 0; i < n_keys; i++)
+    g_free (gnome_config_get_string (abs_paths[i]));
+  g_timer_stop (timer);
+  bench_report ("lookup-cold", n_keys, bench_ns_per (timer, n_keys),
+                "ns/lookup");
+
+  g_timer_start (timer);
+  for (i = 0; i < n_keys; i++)
+    g_free (gnome_config_get_string (abs_paths[i]));
+  g_timer_stop (timer);
+  bench_report ("lookup-warm", n_keys, bench_ns_per (timer, n_keys),
+                "ns/lookup");
+
+  g_timer_start (timer);
+  for (i = 0; i < n_keys; i++)
+    gnome_config_get_int (abs_paths[i]);
+  g_timer_stop (timer);
+  bench_report ("lookup-int", n_keys, bench_ns_per (timer, n_keys),
+                "ns/lookup");
+
+  g_timer_start (timer);
+  for (i = 0; i < n_keys; i++)
+    g_free (gnome_config_get_translated_string (abs_paths[i]));
+  g_timer_stop (timer);
+  bench_report ("lookup-translated", n_keys,
+                bench_ns_per (timer, n_keys), "ns/lookup");
+
+  /* through the three layers */
+  gnome_config_drop_all ();
+  g_timer_start (timer);
+  for (i = 0; i < n_keys; i++)
+    g_free (gnome_config_get_string (paths[i]));
+  g_timer_stop (timer);
+  bench_report ("layered-cold", n_keys, bench_ns_per (timer, n_keys),
+                "ns/lookup");
+
+  g_timer_start (timer);
+  for (i = 0; i < n_keys; i++)
+    g_free (gnome_config_get_string (paths[i]));
+  g_timer_stop (timer);
+  bench_report ("layered-warm", n_keys, bench_ns_per (timer, n_keys),
+                "ns/lookup");
+  bench_report ("memory-layered", n_keys, bench_bytes_per (n_keys),
+                "bytes/key");
+
+  /* changing every key, and writing them out */
+  g_timer_start (timer);
+  for (i = 0; i < n_keys; i++)
+    gnome_config_set_string (paths[i], "changed");
+  g_timer_stop (timer);
+  bench_report ("set", n_keys, bench_ns_per (timer, n_keys), "ns/set");
+
+  g_timer_start (timer);
+  gnome_config_sync ();
+  g_timer_stop (timer);
+  bench_report ("sync", n_keys, bench_ns_per (timer, n_keys), "ns/key");
+
+  gnome_config_drop_all ();
+  for (i = 0; i < n_keys; i++)
+    {
+      g_free (paths[i]);
+      g_free (abs_paths[i]);
+    }
+  g_free (paths);
+  g_free (abs_paths);
+  g_free (filename);
+  g_free (rel);
+  g_timer_destroy (timer);
+}
+
+int
+main (int argc, char *argv[])
+{
+  char *sysconf_dir;
+  int max_keys = 100000;
+  int n_keys;
+
+  if (argc > 1)
+    max_keys = atoi (argv[1]);
+
+  bench_dir = g_strdup_printf ("%s/gnome-config-bench-%d",
+                               g_get_tmp_dir (), (int) getpid ());
+  bench_home = bench_mkdir ("user");
+  bench_sys = bench_mkdir ("etc/gnome/config");
+  bench_override = bench_mkdir ("etc/gnome/config-override");
+  sysconf_dir = g_build_filename (bench_dir, "etc", NULL);
+  /* libgnome creates ${GNOME22_USER_DIR}_private next to it */
+  g_setenv ("GNOME22_USER_DIR", bench_home, TRUE);
+
+  gnome_program_init ("gnome-config-bench", VERSION, LIBGNOME_MODULE,
+                      argc, argv,
+                      GNOME_PARAM_GNOME_SYSCONFDIR, sysconf_dir,
+                      NULL);
+
+  printf ("# benchmark\tkeys\tvalue\tunit\n");
+  for (n_keys = 10; n_keys <= max_keys; n_keys *= 10)
+    bench_keys (n_keys);
+
+  bench_remove (bench_dir);
+
+  g_free (bench_home);
+  g_free (bench_sys);
+  g_free (bench_override);
+  g_free (sysconf_dir);
+  g_free (bench_dir);
+  return 0;
+}
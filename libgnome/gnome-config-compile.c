@@ -0,0 +1,41 @@
+/* Writes the snapshot of the system configuration
+ *
+ * gnome-config maps $(sysconfdir)/gnome/config.snapshot to look the
+ * system wide defaults and mandatory settings up, and parses the files
+ * that changed since it was written as usual.  Nothing runs this
+ * automatically: distributions should run it from a packaging trigger
+ * on the config and config-override directories, so that the snapshot
+ * follows the files every package installs there.
+ */
+
+#include <config.h>
+
+#include <glib.h>
+
+#include <stdio.h>
+
+#include "libgnome-private.h"
+
+int
+main (int argc, char *argv[])
+{
+  GError *err = NULL;
+  const char *dir;
+
+  if (argc > 2)
+    {
+      fprintf (stderr, "Usage: %s [directory]\n", argv[0]);
+      return 1;
+    }
+
+  dir = argc > 1 ? argv[1] : LIBGNOME_SYSCONFDIR "/gnome";
+
+  if (!_gnome_config_compile_snapshot (dir, &err))
+    {
+      fprintf (stderr, "%s: %s\n", argv[0], err->message);
+      g_error_free (err);
+      return 1;
+    }
+
+  return 0;
+}
@@ -36,17 +36,22 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#ifdef HAVE_SYS_INOTIFY_H
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#endif
+
+#ifdef G_OS_WIN32
+/* Microsoft's strtok() is thread-safe, it uses a thread-local buffer */
+#define strtok_r(s, delim, ptrptr) (*(ptrptr) = strtok (s, delim))
+#endif
+
 #include <glib/gi18n-lib.h>
 #include "gnome-util.h"
 #include "gnome-i18n.h"
 #include "gnome-config.h"
-
-#if !defined getc_unlocked && !defined HAVE_GETC_UNLOCKED
-# define getc_unlocked(fp) getc (fp)
-#endif
-
-#define STRSIZE 4096
-#define overflow (next == &CharBuffer [STRSIZE-1])
+#include "libgnome-private.h"
 
 enum {
 	FirstBrace,
@@ -61,6 +66,9 @@ enum {
 typedef struct {
 	int type;
 	void *value;
+	char *filename;		/* of the profile value points into */
+	guint serial;		/* ... and its serial */
+	guint epoch;		/* config_epoch when last checked */
 } iterator_type;
 
 typedef enum {
@@ -68,6 +76,32 @@ typedef enum {
 	SET
 } access_type;
 
+/*
+ * All of the nodes and run time strings of a profile come from a bump
+ * allocator, so that dropping a profile is a matter of freeing a
+ * handful of blocks instead of walking every list.  Nothing is freed on
+ * its own, so profiles that stay in memory across syncs are compacted
+ * once enough of them is dead, see compact_profile().
+ */
+typedef struct ArenaBlock {
+	struct ArenaBlock *next;
+	gsize size;
+	gsize used;
+} ArenaBlock;
+
+typedef struct {
+	ArenaBlock *blocks;	/* the block we allocate from comes first */
+	gsize size;		/* total size of the blocks */
+} ConfigArena;
+
+#define ARENA_HEADER_SIZE \
+	((sizeof (ArenaBlock) + G_MEM_ALIGN - 1) & ~(gsize) (G_MEM_ALIGN - 1))
+#define ARENA_MIN_BLOCK_SIZE 4096
+#define ARENA_MAX_BLOCK_SIZE 65536
+
+/* a profile is compacted once this much, and half of it, is dead */
+#define COMPACT_MIN_DEAD 4096
+
 typedef struct TKeys {
 	char *key_name;
 	char *value;
@@ -80,12 +114,76 @@ typedef struct TSecHeader {
 	struct TSecHeader *link;
 } TSecHeader;
 
+/*
+ * Lookup index for all the section headers of a profile that share a
+ * (case-insensitive) name.  `section' is the first such header in the
+ * list, which is the one a SET without an existing key writes to, and
+ * `keys' maps every key name to the TKeys node a linear walk over the
+ * headers would have found first.  `translations' groups the keys
+ * named like key[lang] by their base key, so that a translated lookup
+ * finds all the languages a key has in one go.  The merged views of
+ * layered files use the same structure, with no `section'.
+ */
+typedef struct {
+	TSecHeader *section;
+	GHashTable *keys;
+	GHashTable *translations; /* base key name -> GPtrArray of TKeys */
+	GHashTable *typed;	/* TKeys -> TTyped, see typed_value() */
+} TSecIndex;
+
+/* which of the values of a TTyped are filled in */
+enum {
+	TYPED_INT = 1 << 0,
+	TYPED_FLOAT = 1 << 1,
+	TYPED_BOOL = 1 << 2,
+	TYPED_VECTOR = 1 << 3
+};
+
+/* the value of a key converted for the typed getters */
+typedef struct {
+	guint have;
+	gint int_value;
+	gdouble float_value;
+	gboolean bool_value;
+	int argc;
+	char **argv;
+} TTyped;
+
+/* what a file looked like on disk when it was loaded */
+typedef struct {
+	time_t mtime;
+	glong mtime_nsec;
+	off_t size;
+	ino_t ino;
+} TStamp;
+
+/*
+ * An inotify watch on a directory holding configuration files.  The
+ * watch thread bumps serial on every change in the directory, and sets
+ * wd to -1 when the kernel drops the watch.
+ */
+typedef struct {
+	volatile gint wd;
+	volatile gint serial;
+} TWatch;
+
 typedef struct TProfile {
 	char *filename;
+	char *text;		/* the file contents, see load() */
+	gsize text_len;
+	ConfigArena arena;	/* nodes and strings set at run time */
 	TSecHeader *section;
-	struct TProfile *link;
+	GHashTable *index;	/* section name -> TSecIndex */
+	GList *lru_link;	/* our node in profile_lru */
+	gsize mem_size;		/* approximate memory used by the profile */
+	gsize dead_bytes;	/* of the text and arena, no longer reachable */
 	time_t last_checked;
-	time_t mtime;
+	TStamp stamp;
+	TWatch *watch;		/* NULL unless watching for changes */
+	gint watch_serial;	/* watch->serial when last checked */
+	gint watch_overflows;
+	guint generation;	/* bumped on every change */
+	guint serial;		/* config_epoch right after loading */
 	gboolean written_to;
 	gboolean to_be_deleted;
 } TProfile;
@@ -93,18 +191,115 @@ typedef struct TProfile {
 /*
  * Prefix for all the configuration operations
  * iff the path does not begin with / or with #
+ *
+ * Every thread has a prefix stack of its own, so that threads pushing
+ * prefixes don't step on each other's paths.
+ */
+
+#define prefix (current_prefix ())
+
+static GStaticPrivate prefix_key = G_STATIC_PRIVATE_INIT;
+
+/*
+ * This one keeps track of all of the opened files, by file name.  The
+ * queue holds the same profiles, most recently used first, so that the
+ * cache can be trimmed down to the limits set with
+ * gnome_config_set_cache_limits().
  */
+static GHashTable *profiles = NULL;
+static GQueue *profile_lru = NULL;
 
-#define prefix (prefix_list ? prefix_list->data : NULL)
+static guint cache_max_profiles = 0;
+static gsize cache_max_bytes = 0;
+static gsize cache_bytes = 0;
+static gulong cache_hits = 0;
+static gulong cache_misses = 0;
+static gulong cache_evictions = 0;
 
-static GSList *prefix_list = NULL;
+/* whether syncing drops the profiles, see gnome_config_set_sync_mode() */
+static GnomeConfigSyncMode sync_mode = GNOME_CONFIG_SYNC_DROP;
 
-static TProfile *Current = NULL;
+/*
+ * Locking.  config_lock protects the cache and the profiles in it.
+ * Lookups take it shared so that any number of threads can read in
+ * parallel, and only come back for it exclusively when a file has to
+ * be (re)loaded first; everything else takes it exclusively.  The few
+ * things lookups do update -- the LRU order, the statistics and the
+ * bookkeeping of when a file was last checked -- are protected by
+ * cache_lock.
+ */
+static GStaticRWLock config_lock = G_STATIC_RW_LOCK_INIT;
+static GStaticMutex cache_lock = G_STATIC_MUTEX_INIT;
+
+/*
+ * returned by the lookup functions running under the shared lock when
+ * a file needs to be loaded before the lookup can be answered
+ */
+static const char * const CONFIG_NEEDS_LOAD = "__(needs load)__";
 
 /*
- * This one keeps track of all of the opened files
+ * Lookups in the files under ~/.gnome2 go through up to three layers,
+ * see access_config_extended().  For every rel_file we remember which
+ * files these are, and, per section, a flattened table mapping every
+ * key to the value it has in the first layer having it.  The tables
+ * point into the profiles, so they are rebuilt whenever a profile is
+ * loaded or dropped (config_epoch changes) or one of the layers is
+ * changed (its generation changes).
  */
-static TProfile *Base = NULL;
+#define MAX_LAYERS 3
+#define LAYER_CACHE_TIMEOUT 2	/* seconds the file names are good for */
+
+typedef struct {
+	int n_files;
+	char *files[MAX_LAYERS];
+	time_t resolved;	/* when the files were located */
+	guint epoch;
+	TProfile *profiles[MAX_LAYERS];	/* NULL for snapshot layers */
+	const struct _SnapFile *snaps[MAX_LAYERS];
+	guint generations[MAX_LAYERS];
+	GHashTable *sections;	/* section name -> merged TSecIndex */
+	ConfigArena arena;	/* TKeys of the snapshot layers */
+} TLayers;
+
+static GHashTable *layer_cache = NULL;	/* rel_file -> TLayers */
+static guint config_epoch = 0;
+
+/* while set, loading a profile doesn't trim the cache */
+static gint trim_inhibit = 0;
+
+static void
+free_prefix_stack (gpointer data)
+{
+	GSList **stack = data;
+
+	while (*stack != NULL) {
+		g_free ((*stack)->data);
+		*stack = g_slist_delete_link (*stack, *stack);
+	}
+	g_free (stack);
+}
+
+/* returns the prefix stack of the calling thread */
+static GSList **
+prefix_stack (void)
+{
+	GSList **stack;
+
+	stack = g_static_private_get (&prefix_key);
+	if (stack == NULL) {
+		stack = g_new0 (GSList *, 1);
+		g_static_private_set (&prefix_key, stack, free_prefix_stack);
+	}
+	return stack;
+}
+
+static const char *
+current_prefix (void)
+{
+	GSList **stack = g_static_private_get (&prefix_key);
+
+	return stack && *stack ? (*stack)->data : NULL;
+}
 
 static char *
 config_concat_dir_and_key (const char *dir, const char *key)
@@ -133,206 +328,749 @@ config_concat_dir_and_key (const char *dir, const char *key)
    static ParsedPath *parse_path (const char *path, gboolean priv); */
 #include "parse-path.cP"
 
+static gpointer
+arena_alloc (ConfigArena *arena, gsize size)
+{
+	ArenaBlock *block = arena->blocks;
+	gpointer mem;
+
+	size = (size + G_MEM_ALIGN - 1) & ~(gsize) (G_MEM_ALIGN - 1);
+	if (block == NULL || block->used + size > block->size){
+		gsize block_size;
+
+		if (block == NULL)
+			block_size = ARENA_MIN_BLOCK_SIZE;
+		else
+			block_size = MIN (block->size * 2, ARENA_MAX_BLOCK_SIZE);
+		block_size = MAX (block_size, size);
+
+		block = g_malloc (ARENA_HEADER_SIZE + block_size);
+		block->next = arena->blocks;
+		block->size = block_size;
+		block->used = 0;
+		arena->blocks = block;
+		arena->size += ARENA_HEADER_SIZE + block_size;
+	}
+
+	mem = (char *) block + ARENA_HEADER_SIZE + block->used;
+	block->used += size;
+	return mem;
+}
+
+static char *
+arena_strdup (ConfigArena *arena, const char *s)
+{
+	gsize len;
+
+	if (s == NULL)
+		return NULL;
+	len = strlen (s) + 1;
+	return memcpy (arena_alloc (arena, len), s, len);
+}
+
 static void
-free_keys (TKeys *p)
+arena_free (ConfigArena *arena)
+{
+	ArenaBlock *block, *next;
+
+	for (block = arena->blocks; block; block = next){
+		next = block->next;
+		g_free (block);
+	}
+	arena->blocks = NULL;
+	arena->size = 0;
+}
+
+/*
+ * Section and key names are matched case-insensitively, so the index
+ * hashes the ASCII-folded name in place instead of storing folded
+ * copies of every string.
+ */
+static guint
+config_str_case_hash (gconstpointer v)
 {
-	if (!p)
+	const char *p;
+	guint32 h = 5381;
+
+	for (p = v; *p != '\0'; p++)
+		h = (h << 5) + h + g_ascii_tolower (*p);
+
+	return h;
+}
+
+static gboolean
+config_str_case_equal (gconstpointer v1, gconstpointer v2)
+{
+	return g_ascii_strcasecmp (v1, v2) == 0;
+}
+
+static void
+free_section_index (gpointer data)
+{
+	TSecIndex *si = data;
+
+	g_hash_table_destroy (si->keys);
+	if (si->translations != NULL)
+		g_hash_table_destroy (si->translations);
+	if (si->typed != NULL)
+		g_hash_table_destroy (si->typed);
+	g_free (si);
+}
+
+static void
+free_typed (gpointer data)
+{
+	TTyped *t = data;
+
+	g_strfreev (t->argv);
+	g_free (t);
+}
+
+/* forgets the converted values of key, when it is set or removed */
+static void
+typed_forget (TSecIndex *si, TKeys *key)
+{
+	g_static_mutex_lock (&cache_lock);
+	if (si->typed != NULL)
+		g_hash_table_remove (si->typed, key);
+	g_static_mutex_unlock (&cache_lock);
+}
+
+static void
+free_translations (gpointer data)
+{
+	g_ptr_array_free (data, TRUE);
+}
+
+/* adds key to the translations of its base key if it's named key[lang] */
+static void
+index_translation (TSecIndex *si, TKeys *key)
+{
+	const char *name = key->key_name;
+	const char *open;
+	GPtrArray *variants;
+	char *base;
+	size_t len;
+
+	len = strlen (name);
+	if (len < 3 || name[len - 1] != ']')
 		return;
-	free_keys (p->link);
-	g_free (p->key_name);
-	g_free (p->value);
+	open = strrchr (name, '[');
+	if (open == NULL || open == name)
+		return;
+
+	if (si->translations == NULL)
+		si->translations = g_hash_table_new_full
+			(config_str_case_hash, config_str_case_equal,
+			 g_free, free_translations);
+
+	base = g_strndup (name, open - name);
+	variants = g_hash_table_lookup (si->translations, base);
+	if (variants == NULL) {
+		variants = g_ptr_array_new ();
+		g_hash_table_insert (si->translations, base, variants);
+	} else
+		g_free (base);
+	g_ptr_array_add (variants, key);
+}
+
+static TSecIndex *
+index_section (TProfile *p, TSecHeader *section)
+{
+	TSecIndex *si;
+
+	si = g_hash_table_lookup (p->index, section->section_name);
+	if (si == NULL) {
+		si = g_new (TSecIndex, 1);
+		si->section = section;
+		si->keys = g_hash_table_new (config_str_case_hash,
+					     config_str_case_equal);
+		si->translations = NULL;
+		si->typed = NULL;
+		g_hash_table_insert (p->index, section->section_name, si);
+	}
+	return si;
+}
+
+/*
+ * (Re)builds the index of a profile from its section list.  The lists
+ * are kept in reverse file order, so the first header or key seen for a
+ * given name is the one that wins, exactly like the linear search used
+ * to behave.
+ */
+static void
+build_index (TProfile *p)
+{
+	TSecHeader *section;
+	TKeys *key;
+
+	if (p->index != NULL)
+		g_hash_table_destroy (p->index);
+	p->index = g_hash_table_new_full (config_str_case_hash,
+					  config_str_case_equal,
+					  NULL, free_section_index);
+
+	for (section = p->section; section; section = section->link){
+		TSecIndex *si;
+
+		if (!section->section_name || !*section->section_name)
+			continue;
+
+		si = index_section (p, section);
+		for (key = section->keys; key; key = key->link){
+			if (!*key->key_name ||
+			    g_hash_table_lookup (si->keys, key->key_name))
+				continue;
+			g_hash_table_insert (si->keys, key->key_name, key);
+			index_translation (si, key);
+		}
+	}
+}
+
+static void
+release_profile (TProfile *p)
+{
+	arena_free (&p->arena);
+	g_free (p->text);
+	if (p->index != NULL)
+		g_hash_table_destroy (p->index);
+	g_free (p->filename);
 	g_free (p);
 }
 
+static gsize
+profile_size (const TProfile *p)
+{
+	return sizeof (TProfile) + strlen (p->filename) + 1 +
+		p->text_len + p->arena.size;
+}
+
 static void
-free_sections (TSecHeader *p)
+profile_resize (TProfile *p, gssize delta)
+{
+	p->mem_size += delta;
+	cache_bytes += delta;
+}
+
+/* allocates from the arena of a profile that is already in the cache */
+static gpointer
+profile_alloc (TProfile *p, gsize size)
 {
-	if (!p)
+	gsize old_size = p->arena.size;
+	gpointer mem;
+
+	mem = arena_alloc (&p->arena, size);
+	profile_resize (p, p->arena.size - old_size);
+	return mem;
+}
+
+static char *
+profile_strdup (TProfile *p, const char *s)
+{
+	gsize len;
+
+	if (s == NULL)
+		return NULL;
+	len = strlen (s) + 1;
+	return memcpy (profile_alloc (p, len), s, len);
+}
+
+/* forgets all of the sections of a profile, keeping the profile itself */
+static void
+clear_profile (TProfile *p)
+{
+	arena_free (&p->arena);
+	g_free (p->text);
+	p->text = NULL;
+	p->text_len = 0;
+	p->section = NULL;
+	p->dead_bytes = 0;
+	p->generation++;
+	/* the sections are freed, so iterators over them must stop */
+	p->serial = ++config_epoch;
+	build_index (p);
+	profile_resize (p, profile_size (p) - p->mem_size);
+}
+
+/* removes a profile from the cache and frees it */
+static void
+drop_profile (TProfile *p)
+{
+	g_hash_table_remove (profiles, p->filename);
+	g_queue_delete_link (profile_lru, p->lru_link);
+	cache_bytes -= p->mem_size;
+	release_profile (p);
+	config_epoch++;
+}
+
+static gboolean
+cache_over_limits (void)
+{
+	if (cache_max_profiles > 0 &&
+	    g_hash_table_size (profiles) > cache_max_profiles)
+		return TRUE;
+	if (cache_max_bytes > 0 && cache_bytes > cache_max_bytes)
+		return TRUE;
+	return FALSE;
+}
+
+/*
+ * evicts the least recently used profiles until the cache fits in its
+ * limits again.  Profiles with changes that have not been synced yet
+ * are never evicted, and neither is keep.
+ */
+static void
+cache_trim (TProfile *keep)
+{
+	GList *l, *prev;
+
+	if (profiles == NULL || trim_inhibit > 0)
 		return;
-	free_sections (p->link);
-	free_keys (p->keys);
-	g_free (p->section_name);
-	p->link = NULL;
-	p->keys = NULL;
-	g_free (p);
+
+	for (l = profile_lru->tail; l && cache_over_limits (); l = prev){
+		TProfile *p = l->data;
+
+		prev = l->prev;
+		if (p == keep || p->written_to || p->to_be_deleted)
+			continue;
+		drop_profile (p);
+		cache_evictions++;
+	}
 }
 
+/* empties the cache, without writing anything out */
 static void
-free_profile (TProfile *p)
+drop_all (void)
 {
-	if (!p)
+	TProfile *p;
+
+	if (profiles == NULL)
 		return;
-	if(Current == p)
-		Current = NULL;
-	free_profile (p->link);
-	free_sections (p->section);
-	g_free (p->filename);
-	g_free (p);
+
+	while ((p = g_queue_pop_head (profile_lru)) != NULL)
+		release_profile (p);
+	g_queue_free (profile_lru);
+	g_hash_table_destroy (profiles);
+	profile_lru = NULL;
+	profiles = NULL;
+	cache_bytes = 0;
+	config_epoch++;
+	if (layer_cache != NULL) {
+		g_hash_table_destroy (layer_cache);
+		layer_cache = NULL;
+	}
 }
 
-static int
-is_loaded (const char *filename, TSecHeader **section)
+/* returns the profile for filename if it is in memory, without checking it */
+static TProfile *
+find_profile (const char *filename)
+{
+	if (profiles == NULL)
+		return NULL;
+	return g_hash_table_lookup (profiles, filename);
+}
+
+static void
+stamp_file (const char *filename, TStamp *stamp)
+{
+	struct stat st;
+
+	if (g_stat (filename, &st) == -1){
+		memset (stamp, 0, sizeof (TStamp));
+		return;
+	}
+
+	stamp->mtime = st.st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+	stamp->mtime_nsec = st.st_mtim.tv_nsec;
+#else
+	stamp->mtime_nsec = 0;
+#endif
+	stamp->size = st.st_size;
+	stamp->ino = st.st_ino;
+}
+
+static gboolean
+stamp_equal (const TStamp *a, const TStamp *b)
+{
+	return a->mtime == b->mtime && a->mtime_nsec == b->mtime_nsec &&
+		a->size == b->size && a->ino == b->ino;
+}
+
+/*
+ * Change notification.  When enabled with
+ * gnome_config_set_watch_changes(), the directory of every file we
+ * load is watched with inotify, and a thread reading the inotify
+ * descriptor bumps the serial of the directory whenever something in
+ * it changes.  A profile whose directory serial did not move is known
+ * to be current without any system call; otherwise it is stat()ed once
+ * to find out whether it was the file itself that changed.
+ */
+static gboolean watch_enabled = FALSE;
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+#define WATCH_MASK (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | \
+		    IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |		\
+		    IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+static int watch_fd = -1;
+static GHashTable *watch_dirs = NULL;	/* directory -> TWatch */
+static GHashTable *watch_wds = NULL;	/* wd -> TWatch, for the thread */
+static GStaticMutex watch_lock = G_STATIC_MUTEX_INIT;
+static volatile gint watch_overflows = 0;
+
+static gpointer
+watch_thread (gpointer data)
+{
+	union {
+		struct inotify_event event;
+		char buf[4096];
+	} u;
+
+	for (;;) {
+		ssize_t len;
+		char *p;
+
+		len = read (watch_fd, u.buf, sizeof (u.buf));
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			break;
+
+		for (p = u.buf; p < u.buf + len;
+		     p += sizeof (struct inotify_event) +
+			     ((struct inotify_event *) p)->len) {
+			struct inotify_event *event = (struct inotify_event *) p;
+			TWatch *w;
+
+			if (event->mask & IN_Q_OVERFLOW) {
+				/* we lost track, everything may be stale */
+				g_atomic_int_inc (&watch_overflows);
+				continue;
+			}
+
+			g_static_mutex_lock (&watch_lock);
+			w = g_hash_table_lookup (watch_wds,
+						 GINT_TO_POINTER (event->wd));
+			if (w != NULL) {
+				if (event->mask & IN_IGNORED) {
+					g_hash_table_remove (watch_wds,
+							     GINT_TO_POINTER (event->wd));
+					w->wd = -1;
+				}
+				g_atomic_int_inc (&w->serial);
+			}
+			g_static_mutex_unlock (&watch_lock);
+		}
+	}
+
+	return NULL;
+}
+
+static gboolean
+watch_start (void)
+{
+	if (watch_fd >= 0)
+		return TRUE;
+
+	/* the notifications come in on a thread of their own */
+	if (!g_thread_supported ())
+		return FALSE;
+
+	watch_fd = inotify_init ();
+	if (watch_fd < 0)
+		return FALSE;
+	fcntl (watch_fd, F_SETFD, FD_CLOEXEC);
+
+	watch_dirs = g_hash_table_new_full (g_str_hash, g_str_equal,
+					    g_free, NULL);
+	watch_wds = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+	if (g_thread_create (watch_thread, NULL, FALSE, NULL) == NULL) {
+		close (watch_fd);
+		watch_fd = -1;
+		g_hash_table_destroy (watch_dirs);
+		g_hash_table_destroy (watch_wds);
+		watch_dirs = watch_wds = NULL;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* returns the watch on the directory holding filename, NULL if we can't */
+static TWatch *
+watch_directory_of (const char *filename)
+{
+	TWatch *w, *old;
+	char *dir;
+	int wd;
+
+	dir = g_path_get_dirname (filename);
+	w = g_hash_table_lookup (watch_dirs, dir);
+	if (w != NULL && g_atomic_int_get (&w->wd) >= 0) {
+		g_free (dir);
+		return w;
+	}
+
+	wd = inotify_add_watch (watch_fd, dir, WATCH_MASK);
+	if (wd < 0) {
+		g_free (dir);
+		return NULL;
+	}
+
+	g_static_mutex_lock (&watch_lock);
+	/* the same directory may be known under another name */
+	old = g_hash_table_lookup (watch_wds, GINT_TO_POINTER (wd));
+	if (old != NULL) {
+		w = old;
+	} else {
+		if (w == NULL)
+			w = g_new0 (TWatch, 1);
+		w->wd = wd;
+		g_hash_table_insert (watch_wds, GINT_TO_POINTER (wd), w);
+	}
+	g_static_mutex_unlock (&watch_lock);
+
+	g_hash_table_replace (watch_dirs, dir, w);
+	return w;
+}
+
+#endif /* HAVE_SYS_INOTIFY_H */
+
+/*
+ * Starts watching the directory of profile p.  force_check makes the
+ * next is_loaded() stat the file even if nothing was reported, for
+ * profiles that were loaded before the watch existed.
+ */
+static void
+watch_profile (TProfile *p, gboolean force_check)
+{
+	p->watch = NULL;
+#ifdef HAVE_SYS_INOTIFY_H
+	if (!watch_enabled)
+		return;
+
+	p->watch = watch_directory_of (p->filename);
+	if (p->watch == NULL)
+		return;
+
+	p->watch_serial = g_atomic_int_get (&p->watch->serial);
+	p->watch_overflows = g_atomic_int_get (&watch_overflows);
+	if (force_check)
+		p->watch_serial--;
+#endif
+}
+
+/* checks whether the file of profile p changed since it was loaded */
+static gboolean
+profile_is_current (TProfile *p)
+{
+	TStamp stamp;
+	time_t now;
+
+#ifdef HAVE_SYS_INOTIFY_H
+	if (watch_enabled && p->watch != NULL &&
+	    g_atomic_int_get (&p->watch->wd) >= 0) {
+		gint serial = g_atomic_int_get (&p->watch->serial);
+		gint overflows = g_atomic_int_get (&watch_overflows);
+
+		if (serial == p->watch_serial &&
+		    overflows == p->watch_overflows)
+			return TRUE;
+
+		stamp_file (p->filename, &stamp);
+		if (!stamp_equal (&stamp, &p->stamp))
+			return FALSE;
+
+		/* note the serials read before the stat(), so that
+		 * changes made in between are not lost */
+		g_static_mutex_lock (&cache_lock);
+		p->watch_serial = serial;
+		p->watch_overflows = overflows;
+		g_static_mutex_unlock (&cache_lock);
+		return TRUE;
+	}
+#endif
+
+	now = time (NULL);
+	if (p->last_checked == now)
+		return TRUE;
+
+	stamp_file (p->filename, &stamp);
+	if (!stamp_equal (&stamp, &p->stamp))
+		return FALSE;
+
+	g_static_mutex_lock (&cache_lock);
+	p->last_checked = now;
+	g_static_mutex_unlock (&cache_lock);
+	return TRUE;
+}
+
+/* moves a profile that is being used to the front of the cache */
+static void
+touch_profile (TProfile *p)
+{
+	g_static_mutex_lock (&cache_lock);
+	g_queue_unlink (profile_lru, p->lru_link);
+	g_queue_push_head_link (profile_lru, p->lru_link);
+	cache_hits++;
+	g_static_mutex_unlock (&cache_lock);
+}
+
+/*
+ * returns the profile for filename if it is loaded and current, NULL
+ * if it has to be loaded first.  Only needs config_lock held shared.
+ */
+static TProfile *
+peek_profile (const char *filename)
+{
+	TProfile *p;
+
+	p = find_profile (filename);
+	if (p == NULL || !profile_is_current (p))
+		return NULL;
+
+	touch_profile (p);
+	return p;
+}
+
+/*
+ * checks whether the profile for filename has been loaded already and
+ * is still current, and returns it.  Profiles whose file changed on
+ * disk are dropped, so config_lock must be held exclusively.
+ */
+static TProfile *
+is_loaded (const char *filename)
 {
-	TProfile *p = Base;
-	TProfile *lastp = NULL;
-	struct stat st;
+	TProfile *p;
 
-	/*
-	 * if the last one we accessed was this one we don't want to
-	 * search
-	 */
-	if (Current && strcasecmp (filename, Current->filename) == 0){
-		if (Current->last_checked != time (NULL)){
-			if (g_stat (filename, &st) == -1)
-				st.st_mtime = 0;
-			if (Current->mtime != st.st_mtime) {
-				free_sections (Current->section);
-				Current->section = NULL;
-				Current->filename[0] = '\0';
-				Current->written_to = TRUE;
-				Current->to_be_deleted = FALSE;
-				Current = NULL;
-				return 0;
-			}
-			Current->last_checked = time (NULL);
-		}
-		*section = Current->section;
-		return 1;
-	}
-
-	while (p){
-		/*search and destroy empty nodes*/
-		if (p->filename[0]=='\0') {
-			TProfile *next = p->link;
-			if(lastp)
-				lastp->link = next;
-			else /*the next one is the first one actually*/
-				Base = next;
-			g_free(p->filename);
-			g_free(p);
-			p = next;
-		} else if (strcasecmp (filename, p->filename) == 0){
-			if (p->last_checked != time (NULL)){
-				if (g_stat (filename, &st) == -1)
-					st.st_mtime = 0;
-				if (p->mtime != st.st_mtime) {
-					if(p == Current)
-						Current = NULL;
-					free_sections (p->section);
-					p->section = NULL;
-					p->filename[0] = '\0';
-					p->written_to = TRUE;
-					p->to_be_deleted = FALSE;
-					return 0;
-				}
-				p->last_checked = time (NULL);
-			}
-			Current = p;
-			*section = p->section;
-			return 1;
-		} else {
-			lastp = p;
-			p = p->link;
-		}
+	p = find_profile (filename);
+	if (p == NULL)
+		return NULL;
+
+	if (!profile_is_current (p)) {
+		drop_profile (p);
+		return NULL;
 	}
-	return 0;
+
+	touch_profile (p);
+	return p;
 }
 
+/*
+ * Undoes the escaping done by append_escaped().  Decoding never
+ * makes a string longer, so this works in place, and strings without
+ * any backslash are not touched at all.
+ */
 static char *
-decode_string_and_dup (char *s)
+decode_string_in_place (char *s)
 {
-	char *p = g_malloc (strlen (s) + 1);
-	char *q = p;
+	char *p, *q;
+
+	q = p = strchr (s, '\\');
+	if (p == NULL)
+		return s;
 
 	do {
-		if (*s == '\\'){
-			switch (*(++s)){
+		if (*p == '\\'){
+			switch (*(++p)){
 			case 'n':
-				*p++ = '\n';
+				*q++ = '\n';
 				break;
 			case '\\':
-				*p++ = '\\';
+				*q++ = '\\';
 				break;
 			case 'r':
-				*p++ = '\r';
+				*q++ = '\r';
 				break;
 			default:
-				*p++ = '\\';
-				*p++ = *s;
+				*q++ = '\\';
+				*q++ = *p;
 			}
 		} else
-			*p++ = *s;
-	} while (*s++);
-	return q;
+			*q++ = *p;
+	} while (*p++);
+	return s;
 }
 
-static char *
-escape_string_and_dup (char *s)
+/* appends s to buf, escaping the characters load() can't take as is */
+static void
+append_escaped (GString *buf, const char *s)
 {
-	char *return_value, *p = s;
-	int len = 0;
+	const char *run;
 
-	if(!s)
-		return g_strdup("");
+	if (s == NULL)
+		return;
+
+	for (run = s; *s; s++){
+		const char *esc;
 
-	while (*p){
-		len++;
-		if (*p == '\n' || *p == '\\' || *p == '\r' || *p == '\0')
-			len++;
-		p++;
-	}
-	return_value = p = (char *) g_malloc (len + 1);
-	if (!return_value)
-		return NULL;
-	do {
 		switch (*s){
 		case '\n':
-			*p++ = '\\';
-			*p++ = 'n';
+			esc = "\\n";
 			break;
 		case '\r':
-			*p++ = '\\';
-			*p++ = 'r';
+			esc = "\\r";
 			break;
 		case '\\':
-			*p++ = '\\';
-			*p++ = '\\';
+			esc = "\\\\";
 			break;
 		default:
-			*p++ = *s;
+			continue;
 		}
-	} while (*s++);
-	return return_value;
+		g_string_append_len (buf, run, s - run);
+		g_string_append_len (buf, esc, 2);
+		run = s + 1;
+	}
+	g_string_append_len (buf, run, s - run);
 }
 
-static TSecHeader *
-load (const char *file)
+/*
+ * Reads the file of profile p in one go and parses it in place: the
+ * section names, key names and values are cut out of the text buffer,
+ * which the profile keeps, so loading allocates nothing but the list
+ * nodes.  Carriage returns are ignored everywhere, like they always
+ * were.
+ */
+static void
+load (TProfile *p)
 {
-	FILE *f;
-	int state;
 	TSecHeader *SecHeader = NULL;
-	char CharBuffer [STRSIZE];
-	char *next = "";		/* Not needed */
-	int c;
+	char *r, *w, *end;
+	char *token = NULL;
+	int state;
 
-	if ((f = g_fopen (file, "r"))==NULL)
-		return NULL;
+	p->section = NULL;
+	p->text = NULL;
+	p->text_len = 0;
+	p->arena.blocks = NULL;
+	p->arena.size = 0;
+
+	/* the contents always come back NUL-terminated */
+	if (!g_file_get_contents (p->filename, &p->text, &p->text_len, NULL))
+		return;
 
+	/* w trails r, the tokens are compacted in place as we go */
 	state = FirstBrace;
-	while ((c = getc_unlocked (f)) != EOF){
+	w = p->text;
+	end = p->text + p->text_len;
+	for (r = p->text; r < end; r++){
+		char c = *r;
+
 		if (c == '\r')		/* Ignore Carriage Return */
 			continue;
 
 		switch (state){
 
 		case OnSecHeader:
-			if (c == ']' || overflow){
-				*next = '\0';
-				next = CharBuffer;
-				SecHeader->section_name = g_strdup (CharBuffer);
+			if (c == ']'){
+				*w = '\0';
+				SecHeader->section_name = token;
 				state = IgnoreToEOL;
 			} else
-				*next++ = c;
+				*w++ = c;
 			break;
 
 		case IgnoreToEOL:
@@ -342,7 +1080,6 @@ load (const char *file)
 					state = FirstBrace;
 				else
 					state = KeyDef;
-				next = CharBuffer;
 			}
 			break;
 
@@ -361,11 +1098,12 @@ load (const char *file)
 				TSecHeader *temp;
 
 				temp = SecHeader;
-				SecHeader = (TSecHeader *) g_malloc (sizeof (TSecHeader));
+				SecHeader = arena_alloc (&p->arena, sizeof (TSecHeader));
 				SecHeader->link = temp;
 				SecHeader->keys = NULL;
+				SecHeader->section_name = NULL;
 				state = OnSecHeader;
-				next = CharBuffer;
+				token = w = r + 1;
 				break;
 			}
 			/* On first pass, don't allow dangling keys */
@@ -375,135 +1113,485 @@ load (const char *file)
 			if ((c == ' ' && state != KeyDefOnKey) || c == '\t')
 				break;
 
-			if (c == '\n' || overflow) { /* Abort Definition */
-				next = CharBuffer;
+			if (c == '\n') { /* Abort Definition */
 				state = KeyDef;
                                 break;
                         }
 
-			if (c == '=' || overflow){
+			if (c == '='){
 				TKeys *temp;
 
+				if (state == KeyDef)	/* empty key name */
+					token = w = r;
 				temp = SecHeader->keys;
-				*next = '\0';
-				SecHeader->keys = (TKeys *) g_malloc (sizeof (TKeys));
+				*w = '\0';
+				SecHeader->keys = arena_alloc (&p->arena, sizeof (TKeys));
 				SecHeader->keys->link = temp;
-				SecHeader->keys->key_name = g_strdup (CharBuffer);
+				SecHeader->keys->key_name = token;
+				SecHeader->keys->value = NULL;
 				state = KeyValue;
-				next = CharBuffer;
+				token = w = r + 1;
 			} else {
-				*next++ = c;
+				if (state == KeyDef)
+					token = w = r;
+				*w++ = c;
 				state = KeyDefOnKey;
 			}
 			break;
 
 		case KeyValue:
-			if (overflow || c == '\n'){
-				*next = '\0';
-				SecHeader->keys->value = decode_string_and_dup (CharBuffer);
-				state = c == '\n' ? KeyDef : IgnoreToEOL;
-				next = CharBuffer;
+			if (c == '\n'){
+				*w = '\0';
+				SecHeader->keys->value = decode_string_in_place (token);
+				state = KeyDef;
 			} else
-				*next++ = c;
+				*w++ = c;
 			break;
 
 		} /* switch */
 
-	} /* while ((c = getc_unlocked (f)) != EOF) */
-	if (c == EOF && state == KeyValue){
-		*next = '\0';
-		SecHeader->keys->value = decode_string_and_dup (CharBuffer);
+	} /* for (r = p->text; r < end; r++) */
+
+	if (state == KeyValue){
+		*w = '\0';
+		SecHeader->keys->value = decode_string_in_place (token);
+	} else if (state == OnSecHeader) {
+		/* unterminated header, nothing will match it */
+		*token = '\0';
+		SecHeader->section_name = token;
 	}
-	fclose (f);
-	return SecHeader;
+	p->section = SecHeader;
 }
 
 static void
-new_key (TSecHeader *section, const char *key_name, const char *value)
+new_key (TProfile *p, TSecIndex *si, const char *key_name, const char *value)
 {
+	TSecHeader *section = si->section;
 	TKeys *key;
 
-	key = (TKeys *) g_malloc (sizeof (TKeys));
-	key->key_name = g_strdup (key_name);
-	key->value   = g_strdup (value);
+	key = profile_alloc (p, sizeof (TKeys));
+	key->key_name = profile_strdup (p, key_name);
+	key->value   = profile_strdup (p, value);
 	key->link = section->keys;
 	section->keys = key;
+	if (*key->key_name) {
+		g_hash_table_replace (si->keys, key->key_name, key);
+		index_translation (si, key);
+	}
+}
+
+/*
+ * Values live in the arena (or the text buffer) and are never freed on
+ * their own, so a new value reuses the storage of the old one whenever
+ * it fits, and is counted as dead otherwise.
+ */
+static void
+set_value (TProfile *p, TKeys *key, const char *value)
+{
+	if (value == key->value)
+		return;
+	if (value != NULL && key->value != NULL &&
+	    strlen (value) <= strlen (key->value))
+		memmove (key->value, value, strlen (value) + 1);
+	else {
+		if (key->value != NULL)
+			p->dead_bytes += strlen (key->value) + 1;
+		key->value = profile_strdup (p, value);
+	}
+}
+
+/* what a key that is cleaned leaves behind in the arena */
+static gsize
+key_size (const TKeys *key)
+{
+	return sizeof (TKeys) + strlen (key->key_name) + 1 +
+		(key->value ? strlen (key->value) + 1 : 0);
+}
+
+/*
+ * Copies the sections and keys of a profile that can still be reached
+ * into a new arena, and frees the old arena and the text buffer.  The
+ * nodes move, so the index is rebuilt and iterators and layer caches
+ * pointing into the profile are invalidated, like when it is reloaded.
+ */
+static void
+compact_profile (TProfile *p)
+{
+	ConfigArena arena;
+	TSecHeader *section, *sections, **section_tail;
+	TKeys *key, **key_tail;
+
+	arena.blocks = NULL;
+	arena.size = 0;
+
+	section_tail = &sections;
+	for (section = p->section; section; section = section->link){
+		TSecHeader *copy;
+
+		if (!section->section_name || !*section->section_name)
+			continue;
+
+		copy = arena_alloc (&arena, sizeof (TSecHeader));
+		copy->section_name = arena_strdup (&arena,
+						   section->section_name);
+		key_tail = &copy->keys;
+		for (key = section->keys; key; key = key->link){
+			TKeys *kcopy;
+
+			if (!*key->key_name)
+				continue;
+
+			kcopy = arena_alloc (&arena, sizeof (TKeys));
+			kcopy->key_name = arena_strdup (&arena, key->key_name);
+			kcopy->value = arena_strdup (&arena, key->value);
+			*key_tail = kcopy;
+			key_tail = &kcopy->link;
+		}
+		*key_tail = NULL;
+		*section_tail = copy;
+		section_tail = &copy->link;
+	}
+	*section_tail = NULL;
+
+	arena_free (&p->arena);
+	g_free (p->text);
+	p->text = NULL;
+	p->text_len = 0;
+	p->arena = arena;
+	p->section = sections;
+	p->dead_bytes = 0;
+	p->generation++;
+	p->serial = ++config_epoch;
+	build_index (p);
+	profile_resize (p, profile_size (p) - p->mem_size);
+}
+
+/* to be called on profiles that stay in memory after being written */
+static void
+maybe_compact_profile (TProfile *p)
+{
+	if (p->dead_bytes >= COMPACT_MIN_DEAD &&
+	    p->dead_bytes * 2 >= p->text_len + p->arena.size)
+		compact_profile (p);
+}
+
+/*
+ * returns the profile for filename, loading it from disk if it is not
+ * in memory yet (or not anymore).  config_lock must be held
+ * exclusively.
+ */
+static TProfile *
+get_profile (const char *filename)
+{
+	TProfile *New;
+
+	New = is_loaded (filename);
+	if (New != NULL)
+		return New;
+	cache_misses++;
+
+	if (profiles == NULL){
+		profiles = g_hash_table_new (config_str_case_hash,
+					     config_str_case_equal);
+		profile_lru = g_queue_new ();
+	}
+
+	New = (TProfile *) g_malloc (sizeof (TProfile));
+	New->filename = g_strdup (filename);
+	New->index = NULL;
+	New->mem_size = 0;
+	New->dead_bytes = 0;
+	New->generation = 0;
+	New->written_to = FALSE;
+	New->to_be_deleted = FALSE;
+	New->last_checked = time (NULL);
+	/* watch before looking, so no change slips through */
+	watch_profile (New, FALSE);
+	stamp_file (filename, &New->stamp);
+	load (New);
+	build_index (New);
+	profile_resize (New, profile_size (New));
+
+	g_hash_table_insert (profiles, New->filename, New);
+	g_queue_push_head (profile_lru, New);
+	New->lru_link = profile_lru->head;
+	New->serial = ++config_epoch;
+	cache_trim (New);
+
+	return New;
 }
 
+/*
+ * looks up or sets a key.  With shared set, config_lock is only held
+ * shared, which is good enough for lookups in files that are loaded
+ * already; CONFIG_NEEDS_LOAD is returned for the others.
+ */
 static const char *
 access_config (access_type mode, const char *section_name,
 	       const char *key_name, const char *def, const char *filename,
-	       gboolean *def_used)
+	       gboolean *def_used, gboolean shared)
 {
 
-	TProfile   *New;
+	TProfile   *profile;
 	TSecHeader *section;
+	TSecIndex  *si;
 	TKeys      *key;
 
 	if (def_used)
 		*def_used = FALSE;
-	if (!is_loaded (filename, &section)){
-		struct stat st;
-		
-		if (g_stat (filename, &st) == -1)
-			st.st_mtime = 0;
-
-		New = (TProfile *) g_malloc (sizeof (TProfile));
-		New->link = Base;
-		New->filename = g_strdup (filename);
-		New->section = load (filename);
-		New->mtime = st.st_mtime;
-		New->written_to = FALSE;
-		New->to_be_deleted = FALSE;
-		New->last_checked = time (NULL);
-		Base = New;
-		section = New->section;
-		Current = New;
-	}
 
-	/* Start search */
-	for (; section; section = section->link){
-		/*if section name empty or deleted or not the one we're
-		  looking for, then search on*/
-		if (!section->section_name ||
-		    !*section->section_name ||
-		    strcasecmp (section->section_name, section_name))
-			continue;
+	if (shared){
+		g_assert (mode == LOOKUP);
+		profile = peek_profile (filename);
+		if (profile == NULL)
+			return CONFIG_NEEDS_LOAD;
+	} else
+		profile = get_profile (filename);
 
-		for (key = section->keys; key; key = key->link){
-			if (strcasecmp (key->key_name, key_name))
-				continue;
+	if (mode == SET)
+		profile->generation++;
+
+	/* Start search */
+	si = g_hash_table_lookup (profile->index, section_name);
+	if (si != NULL){
+		key = g_hash_table_lookup (si->keys, key_name);
+		if (key != NULL){
 			if (mode == SET){
-				g_free (key->value);
-				key->value = g_strdup (def);
-				Current->written_to = TRUE;
+				set_value (profile, key, def);
+				typed_forget (si, key);
+				profile->written_to = TRUE;
 			}
 			return key->value;
 		}
 
 		/* No key found */
 		if (mode == SET){
-			new_key (section, key_name, def);
-			Current->written_to = TRUE;
+			new_key (profile, si, key_name, def);
+			profile->written_to = TRUE;
 			return NULL;
 		}
 	}
 
 	/* Non existent section */
 	if ((mode == SET) && def){
-		section = (TSecHeader *) g_malloc (sizeof (TSecHeader));
-		section->section_name = g_strdup (section_name);
+		section = profile_alloc (profile, sizeof (TSecHeader));
+		section->section_name = profile_strdup (profile, section_name);
 		section->keys = NULL;
-		new_key (section, key_name, def);
-		section->link = Current->section;
-		Current->section = section;
-		Current->written_to = TRUE;
+		section->link = profile->section;
+		profile->section = section;
+		new_key (profile, index_section (profile, section),
+			 key_name, def);
+		profile->written_to = TRUE;
 	}
 	if (def_used)
 		*def_used = TRUE;
 	return def;
 }
 
+#include "config-snapshot.cP"
+
+/*
+ * stores the files a lookup in rel_file goes through, in order, in
+ * files and returns their number: the system wide override file, the
+ * file in ~/.gnome2 and the system wide default file, leaving out the
+ * system wide ones that don't exist.  The names must be freed.
+ */
+static int
+resolve_layer_files (const char *rel_file, char *files[MAX_LAYERS])
+{
+	char *tmp, *filename;
+	int n = 0;
+
+	tmp = config_concat_dir_and_key ("gnome/config-override", rel_file);
+	filename = gnome_program_locate_file (gnome_program_get (),
+					      GNOME_FILE_DOMAIN_CONFIG,
+					      tmp, TRUE, NULL);
+	g_free (tmp);
+	if (filename)
+		files[n++] = filename;
+
+	files[n++] = gnome_util_home_file (rel_file);
+
+	tmp = config_concat_dir_and_key ("gnome/config", rel_file);
+	filename = gnome_program_locate_file (gnome_program_get (),
+					      GNOME_FILE_DOMAIN_CONFIG,
+					      tmp, TRUE, NULL);
+	g_free (tmp);
+	if (filename)
+		files[n++] = filename;
+
+	return n;
+}
+
+static void
+free_layers (gpointer data)
+{
+	TLayers *layers = data;
+
+	while (layers->n_files > 0)
+		g_free (layers->files[--layers->n_files]);
+	if (layers->sections != NULL)
+		g_hash_table_destroy (layers->sections);
+	arena_free (&layers->arena);
+	g_free (layers);
+}
+
+/* checks whether the view of layers can be used as it is */
+static gboolean
+layers_are_current (TLayers *layers)
+{
+	int i;
+
+	if (layers->sections == NULL || layers->epoch != config_epoch)
+		return FALSE;
+
+	for (i = 0; i < layers->n_files; i++) {
+		TProfile *p = layers->profiles[i];
+
+		if (p != NULL && (layers->generations[i] != p->generation ||
+				  !profile_is_current (p)))
+			return FALSE;
+	}
+
+	for (i = 0; i < layers->n_files; i++) {
+		if (layers->profiles[i] != NULL)
+			touch_profile (layers->profiles[i]);
+	}
+	return TRUE;
+}
+
+/*
+ * returns the layers for rel_file, with their profiles loaded.  With
+ * shared set config_lock need only be held shared, and NULL is
+ * returned if anything has to be (re)loaded or (re)built first.
+ */
+static TLayers *
+find_layers (const char *rel_file, gboolean shared)
+{
+	TLayers *layers = NULL;
+	time_t now = time (NULL);
+	int i;
+
+	if (layer_cache != NULL)
+		layers = g_hash_table_lookup (layer_cache, rel_file);
+	if (layers != NULL && now - layers->resolved <= LAYER_CACHE_TIMEOUT &&
+	    layers_are_current (layers))
+		return layers;
+
+	if (shared)
+		return NULL;
+
+	if (layer_cache == NULL)
+		layer_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+						     g_free, free_layers);
+
+	if (layers == NULL || now - layers->resolved > LAYER_CACHE_TIMEOUT) {
+		layers = g_new0 (TLayers, 1);
+		layers->n_files = resolve_layer_files (rel_file,
+						       layers->files);
+		for (i = 0; i < layers->n_files; i++)
+			layers->snaps[i] = snapshot_find_file (layers->files[i]);
+		layers->resolved = now;
+		g_hash_table_replace (layer_cache, g_strdup (rel_file),
+				      layers);
+	}
+
+	/* loading one layer must not evict another */
+	trim_inhibit++;
+	for (i = 0; i < layers->n_files; i++) {
+		if (layers->snaps[i] == NULL)
+			layers->profiles[i] = get_profile (layers->files[i]);
+	}
+	trim_inhibit--;
+
+	for (i = 0; i < layers->n_files; i++) {
+		if (layers->profiles[i] != NULL)
+			layers->generations[i] =
+				layers->profiles[i]->generation;
+	}
+	layers->epoch = config_epoch;
+	if (layers->sections != NULL)
+		g_hash_table_destroy (layers->sections);
+	arena_free (&layers->arena);
+	layers->sections = g_hash_table_new_full
+		(config_str_case_hash, config_str_case_equal,
+		 g_free, free_section_index);
+
+	return layers;
+}
+
+static void
+merge_key (gpointer key_name, gpointer key, gpointer merged)
+{
+	g_hash_table_replace (merged, key_name, key);
+}
+
+static void
+merge_translation (gpointer key_name, gpointer key, gpointer si)
+{
+	index_translation (si, key);
+}
+
+/* adds the keys a section has in a snapshot to merged */
+static void
+merge_snapshot_section (TLayers *layers, const SnapFile *file,
+			const char *section_name, GHashTable *merged)
+{
+	const SnapSection *section;
+	const SnapKey *keys;
+	guint i;
+
+	section = snapshot_find_section (file, section_name);
+	if (section == NULL)
+		return;
+
+	keys = (const SnapKey *) (snapshot_data + section->keys);
+	for (i = 0; i < section->n_keys; i++) {
+		TKeys *key = arena_alloc (&layers->arena, sizeof (TKeys));
+
+		/* the snapshot is read only, but nobody writes to these */
+		key->key_name = (char *) SNAP_STRING (keys[i].name);
+		key->value = (char *) SNAP_STRING (keys[i].value);
+		key->link = NULL;
+		g_hash_table_replace (merged, key->key_name, key);
+	}
+}
+
+/*
+ * builds the flattened view of a section of layers, mapping every key
+ * name to the TKeys node of the first layer having the key
+ */
+static TSecIndex *
+merge_section (TLayers *layers, const char *section_name)
+{
+	GHashTable *merged;
+	TSecIndex *si, *view;
+	int i;
+
+	merged = g_hash_table_new (config_str_case_hash, config_str_case_equal);
+	for (i = layers->n_files - 1; i >= 0; i--) {
+		if (layers->snaps[i] != NULL) {
+			merge_snapshot_section (layers, layers->snaps[i],
+						section_name, merged);
+			continue;
+		}
+		si = g_hash_table_lookup (layers->profiles[i]->index,
+					  section_name);
+		if (si != NULL)
+			g_hash_table_foreach (si->keys, merge_key, merged);
+	}
+
+	view = g_new (TSecIndex, 1);
+	view->section = NULL;
+	view->keys = merged;
+	view->translations = NULL;
+	view->typed = NULL;
+	g_hash_table_foreach (merged, merge_translation, view);
+	g_hash_table_insert (layers->sections, g_strdup (section_name), view);
+
+	return view;
+}
+
 /* an extended version of access_config for looking up values in ~/.gnome2.
  * For writes it falls through to the standard behaviour.
  * For lookups, it first checks for the value in
@@ -518,98 +1606,49 @@ access_config (access_type mode, const char *section_name,
 static const char *
 access_config_extended (access_type mode, const char *section_name,
 			const char *key_name, const char *def,
-			const char *rel_file, gboolean *def_used)
+			const char *rel_file, gboolean *def_used,
+			gboolean shared)
 {
-	char *tmp, *filename;
+	char *filename;
 	const char *ret_val;
-	gboolean internal_def;
-
-	static time_t cache_time = 0;
-	static char *cache_filename = NULL;
-	static char *cache_overrride_filename = NULL;
-	static char *cache_global_filename = NULL;
-	gboolean cache_valid;
-	time_t now;
+	TLayers *layers;
+	TSecIndex *merged;
+	TKeys *key;
 
 	switch (mode) {
 	case SET:
 		/* fall through to normal behaviour */
 		filename = gnome_util_home_file (rel_file);
 		ret_val = access_config (mode, section_name, key_name, def,
-					 filename, def_used);
+					 filename, def_used, shared);
 		g_free(filename);
- 		cache_time = 0;  /* Invalidate cache.  */
+		/* Invalidate cache.  */
+		if (layer_cache != NULL)
+			g_hash_table_remove (layer_cache, rel_file);
 		return ret_val;
 	case LOOKUP:
- 		now = time (NULL);
- 		cache_valid = (cache_filename &&
- 			       strcmp (cache_filename, rel_file) == 0 &&
- 			       now - cache_time <= 2);
- 		if (!cache_valid) {
-			g_free (cache_filename);
-
- 			cache_filename = g_strdup (rel_file);
- 			cache_time = now;
-
-			g_free (cache_overrride_filename);
-
- 			tmp = config_concat_dir_and_key ("gnome/config-override",rel_file);
- 			filename = gnome_program_locate_file
-			    (gnome_program_get (), GNOME_FILE_DOMAIN_CONFIG,
-			     tmp, TRUE, NULL);
- 			g_free (tmp);
- 			cache_overrride_filename = g_strdup (filename);
-
-			g_free (cache_global_filename);
-
-			tmp = config_concat_dir_and_key ("gnome/config", rel_file);
- 			filename = gnome_program_locate_file
-			    (gnome_program_get (), GNOME_FILE_DOMAIN_CONFIG,
-			     tmp, TRUE, NULL);
- 			g_free (tmp);
-			cache_global_filename = g_strdup (filename);
- 		}
-
-		if (cache_overrride_filename) {
-			/* the required config file exists */
-			ret_val = access_config (mode, section_name, key_name,
-						 NULL,
-						 cache_overrride_filename,
-						 &internal_def);
-			if (!internal_def) {
-				if (def_used)
-					*def_used = FALSE;
-				return ret_val;
-			}
-			g_assert (ret_val == NULL);
+		layers = find_layers (rel_file, shared);
+		if (layers == NULL)
+			return CONFIG_NEEDS_LOAD;
+
+		merged = g_hash_table_lookup (layers->sections, section_name);
+		if (merged == NULL) {
+			if (shared)
+				return CONFIG_NEEDS_LOAD;
+			merged = merge_section (layers, section_name);
 		}
 
-		/* fall through to the user config section */
-		filename = gnome_util_home_file (rel_file);
-		ret_val = access_config (mode, section_name, key_name, NULL,
-					 filename, &internal_def);
-		g_free (filename);
-		if (!internal_def) {
+		key = g_hash_table_lookup (merged->keys, key_name);
+		if (key != NULL) {
 			if (def_used)
 				*def_used = FALSE;
-			return ret_val;
-		}
-		g_assert (ret_val == NULL);
-
-		/* fall through to the system wide config default tree */
-		if (cache_global_filename) {
-			/* the file exists */
-			ret_val = access_config (mode, section_name, key_name,
-						 def,
-						 cache_global_filename,
-						 def_used);
-			return ret_val;
-		} else {
-			/* it doesn't -- use the default value */
-			if (def_used)
-				*def_used = TRUE;
-			return def;
+			return key->value;
 		}
+
+		/* none of the layers has it -- use the default value */
+		if (def_used)
+			*def_used = TRUE;
+		return def;
 	}
 	g_assert_not_reached ();
 
@@ -619,28 +1658,51 @@ access_config_extended (access_type mode, const char *section_name,
 	return def;
 }
 
-static void
-dump_keys (GString *profile, TKeys *p)
-{
-	if (!p)
-		return;
-	dump_keys (profile, p->link);
-	if (*p->key_name) {
-		char *t = escape_string_and_dup (p->value);
-		g_string_append_printf (profile, "%s=%s\n", p->key_name, t);
-		g_free (t);
-	}
-}
+/*
+ * serializes a list of sections into buf.  The lists are kept newest
+ * first while the file wants them oldest first, so the nodes are
+ * walked backwards through dump_stack, which like the buffer the
+ * profiles are serialized into is reused from one sync to the next.
+ */
+static GPtrArray *dump_stack = NULL;
+static GString *dump_buffer = NULL;
 
 static void
-dump_sections (GString *profile, TSecHeader *p)
+dump_sections (GString *buf, TSecHeader *sections)
 {
-	if (!p)
-		return;
-	dump_sections (profile, p->link);
-	if (p->section_name && p->section_name [0]){
-		g_string_append_printf (profile, "\n[%s]\n", p->section_name);
-		dump_keys (profile, p->keys);
+	TSecHeader *section;
+	TKeys *key;
+	guint i, j, base;
+
+	if (dump_stack == NULL)
+		dump_stack = g_ptr_array_new ();
+	g_ptr_array_set_size (dump_stack, 0);
+
+	for (section = sections; section; section = section->link)
+		g_ptr_array_add (dump_stack, section);
+
+	for (i = dump_stack->len; i > 0; i--){
+		section = g_ptr_array_index (dump_stack, i - 1);
+		if (!section->section_name || !section->section_name [0])
+			continue;
+
+		g_string_append_len (buf, "\n[", 2);
+		g_string_append (buf, section->section_name);
+		g_string_append_len (buf, "]\n", 2);
+
+		base = dump_stack->len;
+		for (key = section->keys; key; key = key->link)
+			g_ptr_array_add (dump_stack, key);
+		for (j = dump_stack->len; j > base; j--){
+			key = g_ptr_array_index (dump_stack, j - 1);
+			if (!*key->key_name)
+				continue;
+			g_string_append (buf, key->key_name);
+			g_string_append_c (buf, '=');
+			append_escaped (buf, key->value);
+			g_string_append_c (buf, '\n');
+		}
+		g_ptr_array_set_size (dump_stack, base);
 	}
 }
 
@@ -727,17 +1789,46 @@ check_path(char *path, mode_t newmode)
 }
 
 
+/* checks whether the file of p holds len bytes of data and nothing else */
+static gboolean
+file_has_contents (TProfile *p, const char *data, gsize len)
+{
+	TStamp stamp;
+	char *contents;
+	gsize length;
+	gboolean same;
+
+	/* only trust files nobody touched since we read them */
+	stamp_file (p->filename, &stamp);
+	if (stamp.mtime == 0 || !stamp_equal (&stamp, &p->stamp) ||
+	    stamp.size != (off_t) len)
+		return FALSE;
+
+	if (!g_file_get_contents (p->filename, &contents, &length, NULL))
+		return FALSE;
+	same = length == len && memcmp (contents, data, len) == 0;
+	g_free (contents);
+
+	return same;
+}
+
 static gboolean
 dump_sections_to_file (TProfile *p)
 {
 	GError *err = NULL;
-	GString *profile = g_string_new("");
 
-	dump_sections (profile, p->section);
+	if (dump_buffer == NULL)
+		dump_buffer = g_string_sized_new (4096);
+	g_string_truncate (dump_buffer, 0);
 
-	g_file_set_contents(p->filename, profile->str, profile->len, &err);
+	dump_sections (dump_buffer, p->section);
 
-	g_string_free(profile,TRUE);
+	/* setting keys to the values they had doesn't warrant a write */
+	if (file_has_contents (p, dump_buffer->str, dump_buffer->len))
+		return TRUE;
+
+	g_file_set_contents(p->filename, dump_buffer->str, dump_buffer->len,
+			    &err);
 
 	if (err != NULL) {
 		/* TODO Maybe the error should be displayed */
@@ -745,22 +1836,17 @@ dump_sections_to_file (TProfile *p)
 		return FALSE;
 	}
 
+	/* what is in memory is what is on disk now */
+	stamp_file (p->filename, &p->stamp);
 	return TRUE;
 }
 
 
 static gboolean
-dump_profile (TProfile *p, gboolean one_only)
+dump_profile (TProfile *p)
 {
 	gboolean ret = TRUE;
 
-	if (!p)
-		return ret;
-	if(!one_only) {
-		if(!dump_profile (p->link, FALSE))
-			ret = FALSE;
-	}
-
 	/*
 	 * was this profile written to?, if not it's not necessary to dump
 	 * it to disk
@@ -778,16 +1864,13 @@ dump_profile (TProfile *p, gboolean one_only)
 		if(p->to_be_deleted && p->section)
 			p->to_be_deleted = FALSE;
 		if(p->to_be_deleted) {
-			/*remove the file and remove all it's ramaints
-			  from memory*/
+			/*remove the file, the (empty) profile now
+			  reflects what is on disk*/
 			g_unlink(p->filename);
 			/* this already must have been true */
 			/*p->section = 0;*/
-			p->filename [0] = '\0';
-			p->written_to = TRUE;
+			memset (&p->stamp, 0, sizeof (TStamp));
 			p->to_be_deleted = FALSE;
-			if(p==Current)
-				Current = NULL;
 		} else if (check_path(p->filename,0755) &&
 			dump_sections_to_file(p)){
 			/* File written correctly */
@@ -803,6 +1886,67 @@ dump_profile (TProfile *p, gboolean one_only)
 	return ret;
 }
 
+/*
+ * writes out all the changed profiles, keeping them in memory.  Unless
+ * they are about to be dropped anyway, the ones that are mostly dead
+ * are compacted.
+ */
+static gboolean
+flush_profiles (gboolean keep)
+{
+	gboolean ret = TRUE;
+	GList *l;
+
+	if (profiles == NULL)
+		return ret;
+
+	for (l = profile_lru->head; l; l = l->next){
+		if (!dump_profile (l->data))
+			ret = FALSE;
+		if (keep)
+			maybe_compact_profile (l->data);
+	}
+	return ret;
+}
+
+/*
+ * Autosync.  Once enabled with gnome_config_set_autosync(), the first
+ * change to a file schedules a write of all the changed files after
+ * the configured delay, so that a burst of changes makes for a single
+ * write per file.  Pending changes are also written out at exit.
+ */
+static guint autosync_interval = 0;
+static guint autosync_source = 0;
+
+static gboolean
+autosync_timeout (gpointer data)
+{
+	g_static_rw_lock_writer_lock (&config_lock);
+	autosync_source = 0;
+	flush_profiles (TRUE);
+	g_static_rw_lock_writer_unlock (&config_lock);
+
+	return FALSE;
+}
+
+static void
+autosync_at_exit (void)
+{
+	g_static_rw_lock_writer_lock (&config_lock);
+	if (autosync_interval > 0)
+		flush_profiles (FALSE);
+	g_static_rw_lock_writer_unlock (&config_lock);
+}
+
+/* to be called, with config_lock held exclusively, after changing a profile */
+static void
+schedule_autosync (void)
+{
+	if (autosync_interval > 0 && autosync_source == 0)
+		autosync_source = g_timeout_add (autosync_interval,
+						 autosync_timeout, NULL);
+}
+
 /**
  * gnome_config_sync:
  *
@@ -812,6 +1956,9 @@ dump_profile (TProfile *p, gboolean one_only)
  * Note: the gnome-config code does not write anything to the
  * configuration files until this routine is actually invoked.
  *
+ * Unless gnome_config_set_sync_mode() says otherwise, everything
+ * gnome-config holds in memory is dropped afterwards.
+ *
  * Returns: %TRUE if everything went well. %FALSE if any file
  * could not be written to disk.
  */
@@ -819,8 +1966,12 @@ gboolean
 gnome_config_sync (void)
 {
 	gboolean ret;
-	ret = dump_profile (Base, FALSE);
-	gnome_config_drop_all();
+
+	g_static_rw_lock_writer_lock (&config_lock);
+	ret = flush_profiles (sync_mode != GNOME_CONFIG_SYNC_DROP);
+	if (sync_mode == GNOME_CONFIG_SYNC_DROP)
+		drop_all ();
+	g_static_rw_lock_writer_unlock (&config_lock);
 	return ret;
 }
 
@@ -869,16 +2020,17 @@ gnome_config_sync_file_ (char *path, gboolean priv)
 	pp = parse_path (fake_path, priv);
 	g_free (fake_path);
 
-	for (p = Base; p; p = p->link){
-		if (strcmp (pp->file, p->filename) != 0)
-			continue;
-		if(!p->written_to)
-			break;
-		if(!dump_profile (p, TRUE))
+	g_static_rw_lock_writer_lock (&config_lock);
+	p = find_profile (pp->file);
+	if (p != NULL && p->written_to){
+		if(!dump_profile (p))
 			ret = FALSE;
-		gnome_config_drop_file(path);
-		break;
+		if (sync_mode == GNOME_CONFIG_SYNC_DROP)
+			drop_profile (p);
+		else
+			maybe_compact_profile (p);
 	}
+	g_static_rw_lock_writer_unlock (&config_lock);
 	release_path (pp);
 
 	return ret;
@@ -916,19 +2068,15 @@ gnome_config_clean_file_ (const char *path, gboolean priv)
 	pp = parse_path (fake_path, priv);
 	g_free (fake_path);
 
-	Current = NULL;
-
-	for (p = Base; p; p = p->link){
-		if (strcmp (pp->file, p->filename) != 0)
-			continue;
-
-		free_sections (p->section);
-		p->section = NULL;
+	g_static_rw_lock_writer_lock (&config_lock);
+	p = find_profile (pp->file);
+	if (p != NULL){
+		clear_profile (p);
 		p->written_to = TRUE;
 		p->to_be_deleted = TRUE;
-		release_path (pp);
-		return;
+		schedule_autosync ();
 	}
+	g_static_rw_lock_writer_unlock (&config_lock);
 	release_path (pp);
 }
 
@@ -951,7 +2099,6 @@ void
 gnome_config_drop_file_ (const char *path, gboolean priv)
 {
 	TProfile *p;
-	TProfile *last;
 	ParsedPath *pp;
 	char *fake_path;
 
@@ -961,24 +2108,12 @@ gnome_config_drop_file_ (const char *path, gboolean priv)
 	fake_path = config_concat_dir_and_key (path, "section/key");
 	pp = parse_path (fake_path, priv);
 	g_free (fake_path);
-
-	Current = NULL;
-
-	for (last = NULL,p = Base; p; last = p, p = p->link){
-		if (strcmp (pp->file, p->filename) != 0)
-			continue;
-
-		if(last)
-			last->link = p->link;
-		else
-			Base = p->link;
-
-		free_sections (p->section);
-		g_free(p->filename);
-		g_free(p);
-		release_path (pp);
-		return;
-	}
+
+	g_static_rw_lock_writer_lock (&config_lock);
+	p = find_profile (pp->file);
+	if (p != NULL)
+		drop_profile (p);
+	g_static_rw_lock_writer_unlock (&config_lock);
 	release_path (pp);
 }
 
@@ -1007,8 +2142,8 @@ gnome_config_drop_file_ (const char *path, gboolean priv)
 void *
 gnome_config_init_iterator_ (const char *path, gboolean priv)
 {
-	TProfile   *New;
-	TSecHeader *section;
+	TProfile   *profile;
+	TSecIndex  *si;
 	ParsedPath *pp;
 	char *fake_path;
 	iterator_type *iter;
@@ -1018,36 +2153,21 @@ gnome_config_init_iterator_ (const char *path, gboolean priv)
 	pp = parse_path (fake_path, priv);
 	g_free (fake_path);
 
-	if (!is_loaded (pp->file, &section)){
-		struct stat st;
-		
-		if (g_stat (pp->file, &st) == -1){
-			st.st_mtime = 0;
-		}
-
-		New = (TProfile *) g_malloc (sizeof (TProfile));
-		New->link = Base;
-		New->filename = g_strdup (pp->file);
-		New->section = load (pp->file);
-		New->mtime = st.st_mtime;
-		New->last_checked = time (NULL);
-		New->written_to = FALSE;
-		New->to_be_deleted = FALSE;
-		Base = New;
-		section = New->section;
-		Current = New;
-	}
-	for (; section; section = section->link){
-		if (strcasecmp (section->section_name, pp->section))
-			continue;
+	iter = NULL;
+	g_static_rw_lock_writer_lock (&config_lock);
+	profile = get_profile (pp->file);
+	si = g_hash_table_lookup (profile->index, pp->section);
+	if (si != NULL){
 		iter = g_new (iterator_type, 1);
 		iter->type = 0;
-		iter->value = section->keys;
-		release_path (pp);
-		return iter;
+		iter->value = si->section->keys;
+		iter->filename = g_strdup (profile->filename);
+		iter->serial = profile->serial;
+		iter->epoch = config_epoch;
 	}
+	g_static_rw_lock_writer_unlock (&config_lock);
 	release_path (pp);
-	return NULL;
+	return iter;
 }
 
 
@@ -1076,8 +2196,7 @@ gnome_config_init_iterator_ (const char *path, gboolean priv)
 void *
 gnome_config_init_iterator_sections_ (const char *path, gboolean priv)
 {
-	TProfile   *New;
-	TSecHeader *section;
+	TProfile   *profile;
 	ParsedPath *pp;
 	char *fake_path;
 	iterator_type *iter;
@@ -1087,31 +2206,38 @@ gnome_config_init_iterator_sections_ (const char *path, gboolean priv)
 	pp = parse_path (fake_path, priv);
 	g_free (fake_path);
 
-	if (!is_loaded (pp->file, &section)){
-		struct stat st;
-		
-		if (g_stat (pp->file, &st) == -1)
-			st.st_mtime = 0;
-
-		New = (TProfile *) g_malloc (sizeof (TProfile));
-		New->link = Base;
-		New->filename = g_strdup (pp->file);
-		New->section = load (pp->file);
-		New->mtime = st.st_mtime;
-		New->last_checked = time (NULL);
-		New->written_to = FALSE;
-		New->to_be_deleted = FALSE;
-		Base = New;
-		section = New->section;
-		Current = New;
-	}
 	iter = g_new (iterator_type, 1);
 	iter->type = 1;
-	iter->value = section;
+	g_static_rw_lock_writer_lock (&config_lock);
+	profile = get_profile (pp->file);
+	iter->value = profile->section;
+	iter->filename = g_strdup (profile->filename);
+	iter->serial = profile->serial;
+	iter->epoch = config_epoch;
+	g_static_rw_lock_writer_unlock (&config_lock);
 	release_path (pp);
 	return iter;
 }
 
+/*
+ * checks that the profile iter points into is still around: unless a
+ * profile was loaded or dropped since the last check, it has to be.
+ */
+static gboolean
+iterator_is_valid (iterator_type *iter)
+{
+	TProfile *p;
+
+	if (iter->epoch == config_epoch)
+		return TRUE;
+
+	p = find_profile (iter->filename);
+	if (p == NULL || p->serial != iter->serial)
+		return FALSE;
+	iter->epoch = config_epoch;
+	return TRUE;
+}
+
 /**
  * gnome_config_iterator_next:
  * @iterator_handle: A gnome configu iterator handle, returned from any
@@ -1124,6 +2250,10 @@ gnome_config_init_iterator_sections_ (const char *path, gboolean priv)
  *
  * If @value is non-NULL, then @value will point to a g_malloc()ed region that
  * holds the key.
+ *
+ * If the file being iterated over is dropped or reloaded, by this thread
+ * or another one, the iteration ends early.  gnome_config_foreach()
+ * walks a section without copying anything.
  */
 void *
 gnome_config_iterator_next (void *iterator_handle, char **key, char **value)
@@ -1143,6 +2273,9 @@ gnome_config_iterator_next (void *iterator_handle, char **key, char **value)
 	if (value)
 		*value = NULL;
 
+	g_static_rw_lock_reader_lock (&config_lock);
+	if (!iterator_is_valid (iter))
+		iter->value = NULL;
 	if (iter->type == 0){
 		TKeys *keys;
 		keys = iter->value;
@@ -1153,10 +2286,10 @@ gnome_config_iterator_next (void *iterator_handle, char **key, char **value)
 				*value = g_strdup (keys->value);
 			keys   = keys->link;
 			iter->value = keys;
-			return iter;
 		} else {
+			g_free (iter->filename);
 			g_free (iter);
-			return NULL;
+			iter = NULL;
 		}
 	} else {
 		TSecHeader *section;
@@ -1167,12 +2300,159 @@ gnome_config_iterator_next (void *iterator_handle, char **key, char **value)
 				*key = g_strdup (section->section_name);
 			section = section->link;
 			iter->value = section;
-			return iter;
 		} else {
+			g_free (iter->filename);
 			g_free (iter);
-			return NULL;
+			iter = NULL;
+		}
+	}
+	g_static_rw_lock_reader_unlock (&config_lock);
+
+	return iter;
+}
+
+/*
+ * calls func for every key of pp->section, or for every section if
+ * sections is set.  Returns FALSE if shared is set and the file has to
+ * be loaded first.
+ */
+static gboolean
+walk_profile (ParsedPath *pp, gboolean sections, gboolean shared,
+	      GnomeConfigForeachFunc func, gpointer user_data,
+	      gboolean *found)
+{
+	TProfile   *profile;
+	TSecHeader *section;
+	TSecIndex  *si;
+	TKeys      *key;
+
+	if (shared) {
+		profile = peek_profile (pp->file);
+		if (profile == NULL)
+			return FALSE;
+	} else
+		profile = get_profile (pp->file);
+
+	if (sections) {
+		*found = TRUE;
+		for (section = profile->section; section;
+		     section = section->link) {
+			/* cleaned sections have an empty name */
+			if (!section->section_name ||
+			    !*section->section_name)
+				continue;
+			if (!func (section->section_name, NULL, user_data))
+				break;
 		}
+		return TRUE;
+	}
+
+	si = g_hash_table_lookup (profile->index, pp->section);
+	*found = (si != NULL);
+	if (si == NULL)
+		return TRUE;
+	for (key = si->section->keys; key; key = key->link) {
+		/* so do cleaned keys */
+		if (!*key->key_name)
+			continue;
+		if (!func (key->key_name, key->value, user_data))
+			break;
+	}
+	return TRUE;
+}
+
+static gboolean
+foreach_in_path (const char *path, const char *fake_key, gboolean sections,
+		 GnomeConfigForeachFunc func, gpointer user_data,
+		 gboolean priv)
+{
+	ParsedPath *pp;
+	char *fake_path;
+	gboolean found = FALSE;
+
+	g_return_val_if_fail (func != NULL, FALSE);
+
+	fake_path = config_concat_dir_and_key (path, fake_key);
+	pp = parse_path (fake_path, priv);
+	g_free (fake_path);
+
+	g_static_rw_lock_reader_lock (&config_lock);
+	if (walk_profile (pp, sections, TRUE, func, user_data, &found)) {
+		g_static_rw_lock_reader_unlock (&config_lock);
+	} else {
+		g_static_rw_lock_reader_unlock (&config_lock);
+		g_static_rw_lock_writer_lock (&config_lock);
+		walk_profile (pp, sections, FALSE, func, user_data, &found);
+		g_static_rw_lock_writer_unlock (&config_lock);
 	}
+
+	release_path (pp);
+	return found;
+}
+
+/**
+ * gnome_config_foreach:
+ * @path: A gnome configuration path for a section.
+ * @func: The function to call for every key.
+ * @user_data: User data to pass to @func.
+ *
+ * Calls @func with the name and the value of every key in the section
+ * @path refers to, until @func returns %FALSE.  Unlike
+ * gnome_config_iterator_next() nothing is copied: the strings belong
+ * to gnome-config and are only valid during the call.  The file is
+ * locked while it is walked, so @func must not call any gnome_config
+ * function.
+ *
+ * Returns: %TRUE if the section exists.
+ */
+/**
+ * gnome_config_private_foreach:
+ * @path: A gnome configuration path for a section.
+ * @func: The function to call for every key.
+ * @user_data: User data to pass to @func.
+ *
+ * Like gnome_config_foreach(), but for a section in a private gnome
+ * configuration file.
+ *
+ * Returns: %TRUE if the section exists.
+ */
+gboolean
+gnome_config_foreach_ (const char *path, GnomeConfigForeachFunc func,
+		       gpointer user_data, gboolean priv)
+{
+	return foreach_in_path (path, "key", FALSE, func, user_data, priv);
+}
+
+/**
+ * gnome_config_foreach_section:
+ * @path: A gnome configuration path for a file.
+ * @func: The function to call for every section.
+ * @user_data: User data to pass to @func.
+ *
+ * Calls @func with the name of every section in the file @path refers
+ * to, and %NULL for the value, until @func returns %FALSE.  As with
+ * gnome_config_foreach(), the names are only valid during the call and
+ * @func must not call any gnome_config function.
+ *
+ * Returns: %TRUE.
+ */
+/**
+ * gnome_config_private_foreach_section:
+ * @path: A gnome configuration path for a file.
+ * @func: The function to call for every section.
+ * @user_data: User data to pass to @func.
+ *
+ * Like gnome_config_foreach_section(), but for a private gnome
+ * configuration file.
+ *
+ * Returns: %TRUE.
+ */
+gboolean
+gnome_config_foreach_section_ (const char *path, GnomeConfigForeachFunc func,
+			       gpointer user_data, gboolean priv)
+{
+	return foreach_in_path (path, "section/key", TRUE, func, user_data,
+				priv);
 }
 
 /**
@@ -1194,7 +2474,7 @@ gnome_config_iterator_next (void *iterator_handle, char **key, char **value)
 void
 gnome_config_clean_section_ (const char *path, gboolean priv)
 {
-	TProfile   *New;
+	TProfile   *profile;
 	TSecHeader *section;
 	ParsedPath *pp;
 	char *fake_path;
@@ -1203,33 +2483,29 @@ gnome_config_clean_section_ (const char *path, gboolean priv)
 	pp = parse_path (fake_path, priv);
 	g_free (fake_path);
 
-	if (!is_loaded (pp->file, &section)){
-		struct stat st;
-
-		if (g_stat (pp->file, &st) == -1)
-			st.st_mtime = 0;
-
-		New = (TProfile *) g_malloc (sizeof (TProfile));
-		New->link = Base;
-		New->filename = g_strdup (pp->file);
-		New->section = load (pp->file);
-		New->mtime = st.st_mtime;
-		New->last_checked = time (NULL);
-		New->written_to = FALSE;
-		New->to_be_deleted = FALSE;
-		Base = New;
-		section = New->section;
-		Current = New;
-	}
+	g_static_rw_lock_writer_lock (&config_lock);
+	profile = get_profile (pp->file);
 	/* We only disable the section, so it will still be g_freed, but it */
 	/* won't be found by further walks of the structure */
 
-	for (; section; section = section->link){
+	g_hash_table_remove (profile->index, pp->section);
+	profile->generation++;
+	for (section = profile->section; section; section = section->link){
+		TKeys *key;
+
 		if (strcasecmp (section->section_name, pp->section))
 			continue;
+		profile->dead_bytes += sizeof (TSecHeader) +
+			strlen (section->section_name) + 1;
+		for (key = section->keys; key; key = key->link)
+			if (*key->key_name)
+				profile->dead_bytes += key_size (key);
 		section->section_name [0] = '\0';
-		Current->written_to = TRUE;
+		profile->written_to = TRUE;
 	}
+	if (profile->written_to)
+		schedule_autosync ();
+	g_static_rw_lock_writer_unlock (&config_lock);
 	release_path (pp);
 }
 
@@ -1254,41 +2530,38 @@ void
 gnome_config_clean_key_ (const char *path, gboolean priv)
 	/* *section_name, char *file */
 {
-	TProfile   *New;
+	TProfile   *profile;
 	TSecHeader *section;
+	TSecIndex  *si;
 	TKeys *key;
 	ParsedPath *pp;
 
 	pp = parse_path (path, priv);
 
-	if (!is_loaded (pp->file, &section)){
-		struct stat st;
-		
-		if (g_stat (pp->file, &st) == -1)
-			st.st_mtime = 0;
-
-		New = (TProfile *) g_malloc (sizeof (TProfile));
-		New->link = Base;
-		New->filename = g_strdup (pp->file);
-		New->section = load (pp->file);
-		New->mtime = st.st_mtime;
-		New->written_to = FALSE;
-		New->last_checked = time (NULL);
-		New->to_be_deleted = FALSE;
-		Base = New;
-		section = New->section;
-		Current = New;
-	}
-	for (; section; section = section->link){
+	g_static_rw_lock_writer_lock (&config_lock);
+	profile = get_profile (pp->file);
+	si = g_hash_table_lookup (profile->index, pp->section);
+	if (si != NULL) {
+		key = g_hash_table_lookup (si->keys, pp->key);
+		if (key != NULL)
+			typed_forget (si, key);
+		g_hash_table_remove (si->keys, pp->key);
+	}
+	profile->generation++;
+	for (section = profile->section; section; section = section->link){
 	        if (strcasecmp (section->section_name, pp->section))
 		        continue;
 		for (key = section->keys; key; key = key->link){
 			if (strcasecmp (key->key_name, pp->key))
 				continue;
+			profile->dead_bytes += key_size (key);
 			key->key_name [0] = 0;
-			Current->written_to = TRUE;
+			profile->written_to = TRUE;
 		}
 	}
+	if (profile->written_to)
+		schedule_autosync ();
+	g_static_rw_lock_writer_unlock (&config_lock);
 	release_path (pp);
 }
 
@@ -1314,56 +2587,444 @@ gboolean
 gnome_config_has_section_ (const char *path, gboolean priv)
 	/* char *section_name, char *profile */
 {
-	TProfile   *New;
-	TSecHeader *section;
+	TProfile   *profile;
 	ParsedPath *pp;
 	char *fake_path;
+	gboolean ret;
 
 	fake_path = config_concat_dir_and_key (path, "key");
 	pp = parse_path (fake_path,priv);
 	g_free (fake_path);
 
-	if (!is_loaded (pp->file, &section)){
-		struct stat st;
-		
-		if (g_stat (pp->file, &st) == -1)
-			st.st_mtime = 0;
-
-		New = (TProfile *) g_malloc (sizeof (TProfile));
-		New->link = Base;
-		New->filename = g_strdup (pp->file);
-		New->section = load (pp->file);
-		New->mtime = st.st_mtime;
-		New->written_to = FALSE;
-		New->last_checked = time (NULL);
-		New->to_be_deleted = FALSE;
-		Base = New;
-		section = New->section;
-		Current = New;
-	}
-	for (; section; section = section->link){
-		if (strcasecmp (section->section_name, pp->section))
-			continue;
-		release_path (pp);
-		return 1;
+	/* no need to lock exclusively unless the file has to be loaded */
+	g_static_rw_lock_reader_lock (&config_lock);
+	profile = peek_profile (pp->file);
+	if (profile != NULL)
+		ret = g_hash_table_lookup (profile->index, pp->section) != NULL;
+	g_static_rw_lock_reader_unlock (&config_lock);
+
+	if (profile == NULL){
+		g_static_rw_lock_writer_lock (&config_lock);
+		profile = get_profile (pp->file);
+		ret = g_hash_table_lookup (profile->index, pp->section) != NULL;
+		g_static_rw_lock_writer_unlock (&config_lock);
 	}
 	release_path (pp);
-	return 0;
+	return ret;
+}
+
+/**
+ * gnome_config_drop_all:
+ *
+ * Drops any information cached in memory that was fetched with
+ * gnome config. Any pending information that has not been
+ * written to disk is discarded.
+ */
+void
+gnome_config_drop_all (void)
+{
+	g_static_rw_lock_writer_lock (&config_lock);
+	drop_all ();
+	g_static_rw_lock_writer_unlock (&config_lock);
+}
+
+/**
+ * gnome_config_set_cache_limits:
+ * @max_profiles: The maximum number of configuration files to keep in
+ * memory, or 0 for no limit.
+ * @max_bytes: The approximate maximum amount of memory, in bytes, used
+ * by the configuration files kept in memory, or 0 for no limit.
+ *
+ * Bounds the in-memory cache of configuration files.  Whenever a file
+ * is loaded and the cache grows past one of the limits, the least
+ * recently used files that carry no unsynced changes are dropped from
+ * memory; they are transparently reloaded on the next access.
+ *
+ * By default the cache is unbounded.  Note that iterators returned by
+ * gnome_config_init_iterator() and friends are only valid as long as
+ * their file stays in memory, so with a limit set they must not be
+ * held across accesses to other files.
+ */
+void
+gnome_config_set_cache_limits (guint max_profiles, gsize max_bytes)
+{
+	g_static_rw_lock_writer_lock (&config_lock);
+	cache_max_profiles = max_profiles;
+	cache_max_bytes = max_bytes;
+	cache_trim (NULL);
+	g_static_rw_lock_writer_unlock (&config_lock);
+}
+
+/**
+ * gnome_config_get_cache_stats:
+ * @stats: Return location for the statistics.
+ *
+ * Fills @stats with the current size of the in-memory cache of
+ * configuration files and with the number of cache hits, misses and
+ * evictions since the program started.  This is meant to help choosing
+ * the limits passed to gnome_config_set_cache_limits().
+ */
+void
+gnome_config_get_cache_stats (GnomeConfigCacheStats *stats)
+{
+	g_return_if_fail (stats != NULL);
+
+	g_static_rw_lock_reader_lock (&config_lock);
+	g_static_mutex_lock (&cache_lock);
+	stats->profiles = profiles ? g_hash_table_size (profiles) : 0;
+	stats->bytes = cache_bytes;
+	stats->hits = cache_hits;
+	stats->misses = cache_misses;
+	stats->evictions = cache_evictions;
+	g_static_mutex_unlock (&cache_lock);
+	g_static_rw_lock_reader_unlock (&config_lock);
+}
+
+/**
+ * gnome_config_set_watch_changes:
+ * @watch: Whether to watch the configuration files for changes.
+ *
+ * gnome-config notices when a file it holds in memory is changed on
+ * disk by another program.  By default it does so by stat()ing the file
+ * at most once a second whenever it is accessed, which means a system
+ * call on hot paths and changes made within the same second going
+ * unnoticed.
+ *
+ * When @watch is %TRUE and the platform supports it, the directories of
+ * the loaded files are watched with inotify instead.  Accessing a file
+ * then costs no system call unless something in its directory changed,
+ * in which case the modification time (with nanosecond precision where
+ * available), size and inode of the file are compared.  This requires
+ * the GLib thread system to be initialized.
+ *
+ * Returns: %TRUE if change notification is in use, %FALSE if
+ * gnome-config keeps polling the files.
+ */
+gboolean
+gnome_config_set_watch_changes (gboolean watch)
+{
+	GList *l;
+	gboolean ret;
+
+	g_static_rw_lock_writer_lock (&config_lock);
+	watch_enabled = FALSE;
+#ifdef HAVE_SYS_INOTIFY_H
+	if (watch && watch_start ())
+		watch_enabled = TRUE;
+#endif
+
+	if (profiles != NULL) {
+		for (l = profile_lru->head; l; l = l->next)
+			watch_profile (l->data, TRUE);
+	}
+	ret = watch_enabled;
+	g_static_rw_lock_writer_unlock (&config_lock);
+
+	return ret;
+}
+
+/**
+ * gnome_config_set_sync_mode:
+ * @mode: What syncing does with the files held in memory.
+ *
+ * By default (%GNOME_CONFIG_SYNC_DROP) gnome_config_sync() drops all
+ * the files gnome-config holds in memory after writing the changed
+ * ones out, and gnome_config_sync_file() drops the file it wrote, so
+ * that they are read and parsed again on the next access.
+ *
+ * With %GNOME_CONFIG_SYNC_KEEP they are kept in memory instead, which
+ * is what programs that sync often want.  Changes other programs make
+ * to the files are still noticed, see gnome_config_set_watch_changes().
+ *
+ * In either mode files whose contents would not change are not written
+ * to.
+ */
+void
+gnome_config_set_sync_mode (GnomeConfigSyncMode mode)
+{
+	g_static_rw_lock_writer_lock (&config_lock);
+	sync_mode = mode;
+	g_static_rw_lock_writer_unlock (&config_lock);
+}
+
+/**
+ * gnome_config_set_autosync:
+ * @interval: The delay, in milliseconds, after which changes are
+ * written out, or 0 to turn autosync off.
+ *
+ * Normally changes only reach the disk when gnome_config_sync() or
+ * gnome_config_sync_file() is called.  With autosync on, the first
+ * change made to a file schedules all the changed files to be written
+ * out @interval milliseconds later, from the main loop, so that a burst
+ * of changes results in a single write per file.  The files are kept in
+ * memory, as with %GNOME_CONFIG_SYNC_KEEP.  Whatever changes are still
+ * pending when the program exits are written out then.
+ *
+ * Turning autosync off writes out the changes that were pending.
+ */
+void
+gnome_config_set_autosync (guint interval)
+{
+	static gboolean exit_hook = FALSE;
+
+	g_static_rw_lock_writer_lock (&config_lock);
+	autosync_interval = interval;
+	if (autosync_source != 0 && interval == 0){
+		g_source_remove (autosync_source);
+		autosync_source = 0;
+		flush_profiles (TRUE);
+	}
+	if (interval > 0 && !exit_hook){
+		g_atexit (autosync_at_exit);
+		exit_hook = TRUE;
+	}
+	g_static_rw_lock_writer_unlock (&config_lock);
+}
+
+static const char *
+lookup_pp (ParsedPath *pp, gboolean *def, gboolean priv, gboolean shared)
+{
+	/*is there a better way to check if an absolute path has been given?*/
+	if (!priv && pp->opath[0] != '=')
+		return access_config_extended (LOOKUP, pp->section, pp->key,
+					       pp->def, pp->path, def, shared);
+	else
+		return access_config (LOOKUP, pp->section, pp->key, pp->def,
+				      pp->file, def, shared);
+}
+
+/*
+ * finds the index of pp->section, which is the flattened view of the
+ * layers for lookups that go through them.  *si is set to NULL if the
+ * section doesn't exist.  Returns FALSE if shared is set and something
+ * has to be loaded first.
+ */
+static gboolean
+lookup_section_index (ParsedPath *pp, gboolean priv, gboolean shared,
+		      TSecIndex **si)
+{
+	TProfile *profile;
+	TLayers *layers;
+
+	if (!priv && pp->opath[0] != '=') {
+		layers = find_layers (pp->path, shared);
+		if (layers == NULL)
+			return FALSE;
+		*si = g_hash_table_lookup (layers->sections, pp->section);
+		if (*si == NULL) {
+			if (shared)
+				return FALSE;
+			*si = merge_section (layers, pp->section);
+		}
+		return TRUE;
+	}
+
+	if (shared) {
+		profile = peek_profile (pp->file);
+		if (profile == NULL)
+			return FALSE;
+	} else
+		profile = get_profile (pp->file);
+	*si = g_hash_table_lookup (profile->index, pp->section);
+	return TRUE;
+}
+
+/*
+ * same as gnome_config_get_string_with_default_, but using (ParsedPath *)
+ *
+ * The value is looked up with config_lock held shared, which is all it
+ * takes unless one of the files involved has to be loaded; then the
+ * lookup is done again with the lock held exclusively.
+ */
+static char *
+get_string_with_default_from_pp (ParsedPath *pp, gboolean *def, gboolean priv)
+{
+	const char *r;
+	char *ret = NULL;
+
+	g_static_rw_lock_reader_lock (&config_lock);
+	r = lookup_pp (pp, def, priv, TRUE);
+	if (r != CONFIG_NEEDS_LOAD)
+		ret = g_strdup (r);
+	g_static_rw_lock_reader_unlock (&config_lock);
+
+	if (r == CONFIG_NEEDS_LOAD) {
+		g_static_rw_lock_writer_lock (&config_lock);
+		r = lookup_pp (pp, def, priv, FALSE);
+		ret = g_strdup (r);
+		g_static_rw_lock_writer_unlock (&config_lock);
+	}
+	return ret;
+}
+
+/* sets a key, the path has been parsed already */
+static void
+set_pp (ParsedPath *pp, const char *value)
+{
+	g_static_rw_lock_writer_lock (&config_lock);
+	access_config (SET, pp->section, pp->key, value, pp->file, NULL,
+		       FALSE);
+	schedule_autosync ();
+	g_static_rw_lock_writer_unlock (&config_lock);
+}
+
+/*
+ * Converters from the string form of a value to the types handed out
+ * by the typed getters.  value may be NULL.
+ */
+typedef void (*ConvertFunc) (const char *value, gpointer result);
+
+static void
+convert_string (const char *value, gpointer result)
+{
+	*(char **) result = g_strdup (value);
+}
+
+static void
+convert_int (const char *value, gpointer result)
+{
+	*(gint *) result = value ? atoi (value) : 0;
+}
+
+static void
+convert_float (const char *value, gpointer result)
+{
+	*(gdouble *) result = value ? g_ascii_strtod (value, NULL) : 0;
+}
+
+static void
+convert_bool (const char *value, gpointer result)
+{
+	/* If it's not true it has to be false :) */
+	*(gboolean *) result = value != NULL &&
+		(g_ascii_tolower (*value) == 't' ||
+		 g_ascii_tolower (*value) == 'y' || atoi (value));
+}
+
+/* indexed by GnomeConfigValueType */
+static const ConvertFunc converters[] = {
+	convert_string,
+	convert_int,
+	convert_float,
+	convert_bool
+};
+
+/* converts value, which may be NULL, to one of the TYPED_ types */
+static void
+typed_convert (const char *value, guint type, TTyped *t)
+{
+	switch (type) {
+	case TYPED_INT:
+		convert_int (value, &t->int_value);
+		break;
+	case TYPED_FLOAT:
+		convert_float (value, &t->float_value);
+		break;
+	case TYPED_BOOL:
+		convert_bool (value, &t->bool_value);
+		break;
+	case TYPED_VECTOR:
+		if (value != NULL)
+			gnome_config_make_vector (value, &t->argc, &t->argv);
+		else {
+			t->argc = 0;
+			t->argv = NULL;
+		}
+		break;
+	default:
+		g_assert_not_reached ();
+	}
+}
+
+/*
+ * stores the value of key, one of the keys of si, converted to type in
+ * result.  Conversions are remembered in si until the key is set again
+ * or its file is reloaded; vectors are handed out as copies.
+ */
+static void
+typed_value (TSecIndex *si, TKeys *key, guint type, TTyped *result)
+{
+	TTyped *t;
+	int i;
+
+	g_static_mutex_lock (&cache_lock);
+	if (si->typed == NULL)
+		si->typed = g_hash_table_new_full (g_direct_hash,
+						   g_direct_equal,
+						   NULL, free_typed);
+	t = g_hash_table_lookup (si->typed, key);
+	if (t == NULL) {
+		t = g_new0 (TTyped, 1);
+		g_hash_table_insert (si->typed, key, t);
+	}
+	if (!(t->have & type)) {
+		typed_convert (key->value, type, t);
+		t->have |= type;
+	}
+
+	switch (type) {
+	case TYPED_INT:
+		result->int_value = t->int_value;
+		break;
+	case TYPED_FLOAT:
+		result->float_value = t->float_value;
+		break;
+	case TYPED_BOOL:
+		result->bool_value = t->bool_value;
+		break;
+	case TYPED_VECTOR:
+		result->argc = t->argc;
+		result->argv = NULL;
+		if (t->argv != NULL) {
+			result->argv = g_new (char *, t->argc + 1);
+			for (i = 0; i <= t->argc; i++)
+				result->argv[i] = g_strdup (t->argv[i]);
+		}
+		break;
+	}
+	g_static_mutex_unlock (&cache_lock);
+}
+
+/* converts the value pp has in si, which may be NULL, or its default */
+static void
+typed_from_index (ParsedPath *pp, TSecIndex *si, guint type, gboolean *def,
+		  TTyped *result)
+{
+	TKeys *key = NULL;
+
+	if (si != NULL)
+		key = g_hash_table_lookup (si->keys, pp->key);
+	if (def)
+		*def = (key == NULL);
+	if (key != NULL)
+		typed_value (si, key, type, result);
+	else
+		typed_convert (pp->def, type, result);
 }
 
-/**
- * gnome_config_drop_all:
- *
- * Drops any information cached in memory that was fetched with
- * gnome config. Any pending information that has not been
- * written to disk is discarded.
+/*
+ * looks pp up and converts its value to type, going through the cache
+ * of converted values unless the default is used
  */
-void
-gnome_config_drop_all (void)
+static void
+lookup_typed (ParsedPath *pp, guint type, gboolean *def, gboolean priv,
+	      TTyped *result)
 {
-	free_profile (Base);
-	Base = NULL;
-	Current = NULL;
+	TSecIndex *si;
+	gboolean ready;
+
+	g_static_rw_lock_reader_lock (&config_lock);
+	ready = lookup_section_index (pp, priv, TRUE, &si);
+	if (ready)
+		typed_from_index (pp, si, type, def, result);
+	g_static_rw_lock_reader_unlock (&config_lock);
+
+	if (!ready) {
+		g_static_rw_lock_writer_lock (&config_lock);
+		lookup_section_index (pp, priv, FALSE, &si);
+		typed_from_index (pp, si, type, def, result);
+		g_static_rw_lock_writer_unlock (&config_lock);
+	}
 }
 
 /**
@@ -1410,27 +3071,13 @@ gint
 gnome_config_get_int_with_default_ (const char *path, gboolean *def, gboolean priv)
 {
 	ParsedPath *pp;
-	const char *r;
-	int  v;
+	TTyped v;
 
 	pp = parse_path (path, priv);
-	/*is there a better way to check if an absolute path has been given?*/
-	if (!priv && pp->opath[0] != '=')
-		r = access_config_extended (LOOKUP, pp->section, pp->key,
-					    pp->def, pp->path, def);
-	else
-		r = access_config (LOOKUP, pp->section, pp->key, pp->def,
-				   pp->file, def);
-
-	/* It isn't an error if the key is not found.  */
-	if (r == NULL) {
-		release_path (pp);
-		return 0;
-	}
-
-	v = atoi (r);
+	lookup_typed (pp, TYPED_INT, def, priv, &v);
 	release_path (pp);
-	return v;
+
+	return v.int_value;
 }
 
 /**
@@ -1478,75 +3125,99 @@ gdouble
 gnome_config_get_float_with_default_ (const char *path, gboolean *def, gboolean priv)
 {
 	ParsedPath *pp;
-	const char *r;
-	gdouble v;
+	TTyped v;
 
 	pp = parse_path (path, priv);
-	if (!priv && pp->opath[0] != '=')
-		r = access_config_extended (LOOKUP, pp->section, pp->key,
-					    pp->def, pp->path, def);
-	else
-		r = access_config (LOOKUP, pp->section, pp->key, pp->def,
-				   pp->file, def);
+	/* g_ascii_strtod reads values the same in every locale */
+	lookup_typed (pp, TYPED_FLOAT, def, priv, &v);
+	release_path (pp);
 
-	/* It isn't an error if the key is not found.  */
-	if (r == NULL) {
-		release_path (pp);
-		return 0;
-	}
+	return v.float_value;
+}
 
-        /* make sure we read values in a consistent manner */
-	gnome_i18n_push_c_numeric_locale ();
-	v = strtod(r, NULL);
-	gnome_i18n_pop_c_numeric_locale ();
+/* finds the key[lang] variant whose lang is the first lang_len bytes of lang */
+static TKeys *
+find_translation (GPtrArray *variants, size_t base_len,
+		  const char *lang, size_t lang_len)
+{
+	guint i;
 
-	release_path (pp);
-	return v;
+	for (i = 0; i < variants->len; i++) {
+		TKeys *key = g_ptr_array_index (variants, i);
+		const char *name = key->key_name;
+
+		/* cleaned keys have an empty name */
+		if (strlen (name) == base_len + lang_len + 2 &&
+		    g_ascii_strncasecmp (name + base_len + 1,
+					 lang, lang_len) == 0)
+			return key;
+	}
+	return NULL;
 }
 
 /*
- * same as gnome_config_get_string_with_default_, but using (ParsedPath *)
+ * looks up the best translation of key_name in si, going through
+ * languages in order and falling back to the untranslated key.  Empty
+ * translations don't count.
  */
-static char *
-get_string_with_default_from_pp (ParsedPath *pp, gboolean *def, gboolean priv)
+static TKeys *
+lookup_translation (TSecIndex *si, const char *key_name,
+		    const char * const *languages)
 {
-	const char *r;
-	char *ret = NULL;
+	GPtrArray *variants = NULL;
+	size_t base_len;
+	TKeys *key;
+	int i;
 
-	if (!priv && pp->opath[0] != '=')
-		r = access_config_extended (LOOKUP, pp->section, pp->key,
-					    pp->def, pp->path, def);
-	else
-		r = access_config (LOOKUP, pp->section, pp->key, pp->def,
-				   pp->file, def);
-	if (r)
-		ret = g_strdup (r);
-	return ret;
+	if (si->translations != NULL)
+		variants = g_hash_table_lookup (si->translations, key_name);
+
+	if (variants != NULL) {
+		base_len = strlen (key_name);
+		for (i = 0; languages[i] != NULL; i++) {
+			const char *lang = languages[i];
+			size_t n;
+
+			key = find_translation (variants, base_len,
+						lang, strlen (lang));
+			if (key != NULL && key->value && *key->value)
+				return key;
+
+			/* Sometimes the locale info looks
+			   like `pt_PT@verbose'.  In this case
+			   we want to try `pt' as a backup.  */
+			n = strcspn (lang, "@_");
+			if (lang[n]) {
+				key = find_translation (variants, base_len,
+							lang, n);
+				if (key != NULL && key->value && *key->value)
+					return key;
+			}
+		}
+	}
+
+	return g_hash_table_lookup (si->keys, key_name);
 }
 
 /*
- * like get_string_with_default_from_pp but with language
- * This is because we must work on the parsed path to add the language
- * thingie.
+ * looks up the translated value of pp, or CONFIG_NEEDS_LOAD if shared is
+ * set and something has to be loaded first
  */
-static char *
-get_string_with_default_from_pp_with_lang (ParsedPath *pp,
-					   const char *lang,
-					   gboolean *def,
-					   gboolean priv)
+static const char *
+lookup_translated_pp (ParsedPath *pp, const char * const *languages,
+		      gboolean *def, gboolean priv, gboolean shared)
 {
-	char *value;
-	char *oldkey;
+	TSecIndex *si;
+	TKeys *key = NULL;
 
-	/* switch the key in the key from underneath it, then
-	 * return it back */
-	oldkey = pp->key;
-	pp->key = g_strconcat (oldkey, "[", lang, "]", NULL);
-	value = get_string_with_default_from_pp (pp, def, priv);
-	g_free (pp->key);
-	pp->key = oldkey;
+	if (!lookup_section_index (pp, priv, shared, &si))
+		return CONFIG_NEEDS_LOAD;
 
-	return value;
+	if (si != NULL)
+		key = lookup_translation (si, pp->key, languages);
+	if (def)
+		*def = (key == NULL);
+	return key ? key->value : pp->def;
 }
 
 /**
@@ -1604,57 +3275,31 @@ gnome_config_get_translated_string_with_default_ (const char *path,
 {
 	ParsedPath *pp;
 	const char * const *language_list;
-	gboolean local_def = FALSE;
-	int i;
-
-	char *value= NULL;
+	const char *r;
+	char *value = NULL;
 
 	language_list = g_get_language_names ();
 
 	pp = parse_path (path, priv);
 
-	i = 0;
-	while (!value && language_list[i] != NULL) {
-		const char *lang = language_list[i];
-
-		value = get_string_with_default_from_pp_with_lang
-			(pp, lang, &local_def, priv);
-
-		if (local_def || !value || *value == '\0') {
-			size_t n;
-
-			g_free (value);
-			value= NULL;
-
-			/* Sometimes the locale info looks
-			   like `pt_PT@verbose'.  In this case
-			   we want to try `pt' as a backup.  */
-			n = strcspn (lang, "@_");
-			if (lang[n]) {
-				char *copy = g_strndup (lang, n);
-
-				value = get_string_with_default_from_pp_with_lang (pp, copy, &local_def, priv);
-				g_free (copy);
-				if (local_def || ! value || *value == '\0') {
-					g_free (value);
-					value = NULL;
-				}
-			}
-		}
-		i++;
-	}
-
-	if (def != NULL) {
-		*def = local_def;
+	/* all the languages are resolved in one lookup, see
+	 * lookup_translation() */
+	g_static_rw_lock_reader_lock (&config_lock);
+	r = lookup_translated_pp (pp, language_list, def, priv, TRUE);
+	if (r != CONFIG_NEEDS_LOAD)
+		value = g_strdup (r);
+	g_static_rw_lock_reader_unlock (&config_lock);
+
+	if (r == CONFIG_NEEDS_LOAD) {
+		g_static_rw_lock_writer_lock (&config_lock);
+		r = lookup_translated_pp (pp, language_list, def, priv, FALSE);
+		value = g_strdup (r);
+		g_static_rw_lock_writer_unlock (&config_lock);
 	}
 
-	if (!value){
-		value = get_string_with_default_from_pp (pp, def, priv);
-
-		if (!value || *value == '\0'){
-			g_free (value);
-			value = NULL;
-		}
+	if (value != NULL && *value == '\0') {
+		g_free (value);
+		value = NULL;
 	}
 
 	release_path (pp);
@@ -1763,31 +3408,13 @@ gnome_config_get_bool_with_default_ (const char *path, gboolean *def,
 				     gboolean priv)
 {
 	ParsedPath *pp;
-	const char *r;
-	int  v;
+	TTyped v;
 
 	pp = parse_path (path, priv);
-	if (!priv && pp->opath[0] != '=')
-		r = access_config_extended (LOOKUP, pp->section, pp->key,
-					    pp->def, pp->path, def);
-	else
-		r = access_config (LOOKUP, pp->section, pp->key, pp->def,
-				   pp->file, def);
-
-	/* It isn't an error if the key is not found.  */
-	if (r == NULL) {
-		release_path (pp);
-		return 0;
-	}
-
-	if (g_ascii_tolower(*r) == 't' || g_ascii_tolower(*r) == 'y' || atoi(r)) {
-	  v = 1;
-	} else {
-	  /* If it's not true it has to be false :) */
-	  v = 0;
-	}
+	lookup_typed (pp, TYPED_BOOL, def, priv, &v);
 	release_path (pp);
-	return v;
+
+	return v.bool_value;
 }
 
 /**
@@ -1912,22 +3539,295 @@ gnome_config_get_vector_with_default_ (const char *path, int *argcp,
 				       char ***argvp, gboolean *def, gboolean priv)
 {
 	ParsedPath *pp;
-	const char *rr;
+	TTyped v;
 
 	pp = parse_path (path, priv);
-	if (!priv && pp->opath[0] != '=')
-		rr = access_config_extended (LOOKUP, pp->section, pp->key,
-					     pp->def, pp->path, def);
-	else
-		rr = access_config (LOOKUP, pp->section, pp->key, pp->def,
-				    pp->file, def);
+	lookup_typed (pp, TYPED_VECTOR, def, priv, &v);
+	release_path (pp);
+
+	*argcp = v.argc;
+	*argvp = v.argv;
+}
+
+/* fills in the values of keys from table, which may be NULL */
+static gint
+get_keys_from_table (GHashTable *table, GnomeConfigKey *keys, gint n_keys)
+{
+	gint i, found = 0;
+
+	for (i = 0; i < n_keys; i++) {
+		GnomeConfigKey *k = &keys[i];
+		const char *def, *r = NULL;
+		char *name = NULL;
+		TKeys *key = NULL;
+
+		def = strchr (k->key, '=');
+		if (def != NULL)
+			name = g_strndup (k->key, def++ - k->key);
+
+		if (table != NULL)
+			key = g_hash_table_lookup (table, name ? name : k->key);
+		g_free (name);
+
+		k->def = (key == NULL);
+		if (key == NULL)
+			r = def;
+		else {
+			r = key->value;
+			found++;
+		}
+
+		if (k->type < G_N_ELEMENTS (converters))
+			converters[k->type] (r, k->value);
+		else
+			g_warning ("unknown gnome config value type %d",
+				   k->type);
+	}
+
+	return found;
+}
+
+/**
+ * gnome_config_get_keys:
+ * @path: A gnome configuration path to a section.
+ * @keys: The keys to look up.
+ * @n_keys: The number of elements in @keys.
+ *
+ * Retrieves the values of several keys of the same section at once.
+ * For every element of @keys, the value of the key named by its @key
+ * field (which, like in a path, may be followed by "=default") is
+ * converted to @type and stored where its @value field points to, and
+ * its @def field is set if the default was used.  Strings are returned
+ * newly allocated and must be freed with g_free().
+ *
+ * This gives the same results as fetching the keys one at a time, but
+ * the path is parsed and the files and the section are looked up only
+ * once.
+ *
+ * Returns: The number of keys that were found in the configuration.
+ */
+/**
+ * gnome_config_private_get_keys:
+ * @path: A gnome configuration path to a section in the user-private
+ * namespace.
+ * @keys: The keys to look up.
+ * @n_keys: The number of elements in @keys.
+ *
+ * Retrieves the values of several keys of the same section of a
+ * private configuration file at once; see gnome_config_get_keys().
+ *
+ * Returns: The number of keys that were found in the configuration.
+ */
+gint
+gnome_config_get_keys_ (const char *path, GnomeConfigKey *keys,
+			gint n_keys, gboolean priv)
+{
+	TSecIndex *si;
+	ParsedPath *pp;
+	char *fake_path;
+	gboolean ready;
+	gint found;
+
+	g_return_val_if_fail (path != NULL, 0);
+	g_return_val_if_fail (keys != NULL || n_keys == 0, 0);
+
+	fake_path = config_concat_dir_and_key (path, "key");
+	pp = parse_path (fake_path, priv);
+	g_free (fake_path);
+
+	g_static_rw_lock_reader_lock (&config_lock);
+	ready = lookup_section_index (pp, priv, TRUE, &si);
+	if (ready)
+		found = get_keys_from_table (si ? si->keys : NULL,
+					     keys, n_keys);
+	g_static_rw_lock_reader_unlock (&config_lock);
+
+	if (!ready) {
+		g_static_rw_lock_writer_lock (&config_lock);
+		lookup_section_index (pp, priv, FALSE, &si);
+		found = get_keys_from_table (si ? si->keys : NULL,
+					     keys, n_keys);
+		g_static_rw_lock_writer_unlock (&config_lock);
+	}
 
-	if (rr == NULL) {
-		*argvp = NULL;
-		*argcp = 0;
-	} else
-		gnome_config_make_vector (rr, argcp, argvp);
 	release_path (pp);
+	return found;
+}
+
+/*
+ * A path parsed once and for all.  Lookups go through the same layer
+ * cache as the other lookups do, so files that appear or go away later
+ * are noticed just as soon.  Handles are never changed after they are
+ * created, so they can be shared between threads.
+ */
+struct _GnomeConfigPath {
+	ParsedPath *pp;
+	gboolean priv;
+};
+
+/**
+ * gnome_config_path_new:
+ * @path: A gnome configuration path to a key.
+ *
+ * Parses @path into a handle that can be used over and over again with
+ * gnome_config_path_get_string() and friends, instead of having the
+ * path parsed on every access.  The current prefix, if any, is applied
+ * now.
+ *
+ * Returns: A newly allocated handle, to be freed with
+ * gnome_config_path_free().
+ */
+/**
+ * gnome_config_private_path_new:
+ * @path: A gnome configuration path to a key in the user-private
+ * namespace.
+ *
+ * Parses @path into a handle for a key in a private configuration
+ * file; see gnome_config_path_new().
+ *
+ * Returns: A newly allocated handle, to be freed with
+ * gnome_config_path_free().
+ */
+GnomeConfigPath *
+gnome_config_path_new_ (const char *path, gboolean priv)
+{
+	GnomeConfigPath *cpath;
+
+	g_return_val_if_fail (path != NULL, NULL);
+
+	cpath = g_new (GnomeConfigPath, 1);
+	cpath->pp = parse_path (path, priv);
+	cpath->priv = priv;
+	return cpath;
+}
+
+/**
+ * gnome_config_path_free:
+ * @cpath: A handle returned by gnome_config_path_new().
+ *
+ * Frees @cpath.
+ */
+void
+gnome_config_path_free (GnomeConfigPath *cpath)
+{
+	if (cpath == NULL)
+		return;
+
+	release_path (cpath->pp);
+	g_free (cpath);
+}
+
+/* looks the value of cpath up and converts it into result */
+static void
+path_get (GnomeConfigPath *cpath, gboolean *def, ConvertFunc convert,
+	  gpointer result)
+{
+	ParsedPath *pp = cpath->pp;
+	const char *r;
+
+	g_static_rw_lock_reader_lock (&config_lock);
+	r = lookup_pp (pp, def, cpath->priv, TRUE);
+	if (r != CONFIG_NEEDS_LOAD)
+		convert (r, result);
+	g_static_rw_lock_reader_unlock (&config_lock);
+
+	if (r == CONFIG_NEEDS_LOAD) {
+		g_static_rw_lock_writer_lock (&config_lock);
+		r = lookup_pp (pp, def, cpath->priv, FALSE);
+		convert (r, result);
+		g_static_rw_lock_writer_unlock (&config_lock);
+	}
+}
+
+/**
+ * gnome_config_path_get_string:
+ * @cpath: A handle returned by gnome_config_path_new().
+ * @def: A pointer to a flag that will be set if the default value for
+ * the item is returned, or %NULL.
+ *
+ * Retrieves the value of the configuration item @cpath refers to, the
+ * same way gnome_config_get_string_with_default() does.
+ *
+ * Returns: A newly allocated string, or %NULL.
+ */
+char *
+gnome_config_path_get_string (GnomeConfigPath *cpath, gboolean *def)
+{
+	char *v;
+
+	g_return_val_if_fail (cpath != NULL, NULL);
+
+	path_get (cpath, def, convert_string, &v);
+	return v;
+}
+
+/**
+ * gnome_config_path_get_int:
+ * @cpath: A handle returned by gnome_config_path_new().
+ * @def: A pointer to a flag that will be set if the default value for
+ * the item is returned, or %NULL.
+ *
+ * Retrieves the value of the configuration item @cpath refers to as an
+ * integer.  This neither parses a path nor allocates memory, unless the
+ * file has to be loaded.
+ *
+ * Returns: The value of the configuration item.
+ */
+gint
+gnome_config_path_get_int (GnomeConfigPath *cpath, gboolean *def)
+{
+	gint v;
+
+	g_return_val_if_fail (cpath != NULL, 0);
+
+	path_get (cpath, def, convert_int, &v);
+	return v;
+}
+
+/**
+ * gnome_config_path_get_float:
+ * @cpath: A handle returned by gnome_config_path_new().
+ * @def: A pointer to a flag that will be set if the default value for
+ * the item is returned, or %NULL.
+ *
+ * Retrieves the value of the configuration item @cpath refers to as a
+ * floating point number.  This neither parses a path nor allocates
+ * memory, unless the file has to be loaded.
+ *
+ * Returns: The value of the configuration item.
+ */
+gdouble
+gnome_config_path_get_float (GnomeConfigPath *cpath, gboolean *def)
+{
+	gdouble v;
+
+	g_return_val_if_fail (cpath != NULL, 0);
+
+	path_get (cpath, def, convert_float, &v);
+	return v;
+}
+
+/**
+ * gnome_config_path_get_bool:
+ * @cpath: A handle returned by gnome_config_path_new().
+ * @def: A pointer to a flag that will be set if the default value for
+ * the item is returned, or %NULL.
+ *
+ * Retrieves the value of the configuration item @cpath refers to as a
+ * boolean.  This neither parses a path nor allocates memory, unless
+ * the file has to be loaded.
+ *
+ * Returns: The value of the configuration item.
+ */
+gboolean
+gnome_config_path_get_bool (GnomeConfigPath *cpath, gboolean *def)
+{
+	gboolean v;
+
+	g_return_val_if_fail (cpath != NULL, FALSE);
+
+	path_get (cpath, def, convert_bool, &v);
+	return v;
 }
 
 /**
@@ -1988,11 +3888,9 @@ void
 gnome_config_set_string_ (const char *path, const char *new_value, gboolean priv)
 {
 	ParsedPath *pp;
-	const char *r;
 
 	pp = parse_path (path, priv);
-	r = access_config (SET, pp->section, pp->key, new_value, pp->file,
-			   NULL);
+	set_pp (pp, new_value);
 	release_path (pp);
 }
 
@@ -2018,12 +3916,10 @@ gnome_config_set_int_ (const char *path, int new_value, gboolean priv)
 {
 	ParsedPath *pp;
 	char intbuf [40];
-	const char *r;
 
 	pp = parse_path (path, priv);
 	g_snprintf (intbuf, sizeof(intbuf), "%d", new_value);
-	r = access_config (SET, pp->section, pp->key, intbuf, pp->file,
-			   NULL);
+	set_pp (pp, intbuf);
 	release_path (pp);
 }
 
@@ -2049,17 +3945,13 @@ gnome_config_set_float_ (const char *path, gdouble new_value, gboolean priv)
 {
 	ParsedPath *pp;
 	char floatbuf [40];
-	const char *r;
 
 	pp = parse_path (path, priv);
 
-        /* make sure we write values in a consistent manner */
-	gnome_i18n_push_c_numeric_locale ();
-	g_snprintf (floatbuf, sizeof(floatbuf), "%.17g", new_value);
-	gnome_i18n_pop_c_numeric_locale ();
+	/* make sure we write values in a consistent manner */
+	g_ascii_formatd (floatbuf, sizeof(floatbuf), "%.17g", new_value);
 
-	r = access_config (SET, pp->section, pp->key, floatbuf, pp->file,
-			   NULL);
+	set_pp (pp, floatbuf);
 	release_path (pp);
 }
 
@@ -2083,11 +3975,9 @@ void
 gnome_config_set_bool_ (const char *path, gboolean new_value, gboolean priv)
 {
 	ParsedPath *pp;
-	const char *r;
 
 	pp = parse_path (path, priv);
-	r = access_config (SET, pp->section, pp->key,
-			   new_value ? "true" : "false", pp->file, NULL);
+	set_pp (pp, new_value ? "true" : "false");
 	release_path (pp);
 }
 
@@ -2160,11 +4050,77 @@ gnome_config_set_vector_ (const char *path, int argc,
 
 	pp = parse_path (path, priv);
 	s = gnome_config_assemble_vector (argc, argv);
-	access_config (SET, pp->section, pp->key, s, pp->file, NULL);
+	set_pp (pp, s);
 	g_free (s);
 	release_path (pp);
 }
 
+/**
+ * gnome_config_path_set_string:
+ * @cpath: A handle returned by gnome_config_path_new().
+ * @value: The string to store.
+ *
+ * Stores @value in the configuration item @cpath refers to.
+ */
+void
+gnome_config_path_set_string (GnomeConfigPath *cpath, const char *value)
+{
+	g_return_if_fail (cpath != NULL);
+
+	set_pp (cpath->pp, value);
+}
+
+/**
+ * gnome_config_path_set_int:
+ * @cpath: A handle returned by gnome_config_path_new().
+ * @value: The integer to store.
+ *
+ * Stores @value in the configuration item @cpath refers to.
+ */
+void
+gnome_config_path_set_int (GnomeConfigPath *cpath, gint value)
+{
+	char intbuf [40];
+
+	g_return_if_fail (cpath != NULL);
+
+	g_snprintf (intbuf, sizeof(intbuf), "%d", value);
+	set_pp (cpath->pp, intbuf);
+}
+
+/**
+ * gnome_config_path_set_float:
+ * @cpath: A handle returned by gnome_config_path_new().
+ * @value: The number to store.
+ *
+ * Stores @value in the configuration item @cpath refers to.
+ */
+void
+gnome_config_path_set_float (GnomeConfigPath *cpath, gdouble value)
+{
+	char floatbuf [40];
+
+	g_return_if_fail (cpath != NULL);
+
+	g_ascii_formatd (floatbuf, sizeof(floatbuf), "%.17g", value);
+	set_pp (cpath->pp, floatbuf);
+}
+
+/**
+ * gnome_config_path_set_bool:
+ * @cpath: A handle returned by gnome_config_path_new().
+ * @value: The boolean to store.
+ *
+ * Stores @value in the configuration item @cpath refers to.
+ */
+void
+gnome_config_path_set_bool (GnomeConfigPath *cpath, gboolean value)
+{
+	g_return_if_fail (cpath != NULL);
+
+	set_pp (cpath->pp, value ? "true" : "false");
+}
+
 /**
  * gnome_config_push_prefix:
  * @path: A gnome configuration path prefix.
@@ -2177,11 +4133,16 @@ gnome_config_set_vector_ (const char *path, int argc,
  * Library code will usually have to set the prefix before doing
  * any gnome-configuration access, since the application might
  * be using their own prefix.
+ *
+ * Each thread has its own stack of prefixes, so a prefix pushed in one
+ * thread does not affect the paths used in the others.
  */
 void
 gnome_config_push_prefix (const char *path)
 {
-	prefix_list = g_slist_prepend(prefix_list, g_strdup(path));
+	GSList **stack = prefix_stack ();
+
+	*stack = g_slist_prepend(*stack, g_strdup(path));
 }
 
 /**
@@ -2192,10 +4153,12 @@ gnome_config_push_prefix (const char *path)
 void
 gnome_config_pop_prefix (void)
 {
-	if(prefix_list) {
-		GSList *plist = prefix_list;
-		g_free(prefix_list->data);
-		prefix_list = prefix_list->next;
+	GSList **stack = prefix_stack ();
+
+	if(*stack) {
+		GSList *plist = *stack;
+		g_free(plist->data);
+		*stack = plist->next;
 		g_slist_free_1(plist);
 	}
 }
@@ -158,6 +158,48 @@ void gnome_config_get_vector_with_default_     (const char *path, gint *argcp,
         (gnome_config_get_vector_with_default_ ((path), (argcp), (argvp), \
         					NULL, TRUE))
 
+/* Fetch several keys of /file/section at once */
+typedef enum {
+	GNOME_CONFIG_VALUE_STRING,	/* value is a char **, g_free() it */
+	GNOME_CONFIG_VALUE_INT,		/* value is a gint * */
+	GNOME_CONFIG_VALUE_FLOAT,	/* value is a gdouble * */
+	GNOME_CONFIG_VALUE_BOOL		/* value is a gboolean * */
+} GnomeConfigValueType;
+
+typedef struct {
+	const char *key;		/* key[=default] */
+	GnomeConfigValueType type;
+	gpointer value;			/* where to store the value */
+	gboolean def;			/* set if the default was used */
+} GnomeConfigKey;
+
+gint gnome_config_get_keys_ (const char *path, GnomeConfigKey *keys,
+			     gint n_keys, gboolean priv);
+#define gnome_config_get_keys(path,keys,n_keys) \
+	(gnome_config_get_keys_((path),(keys),(n_keys),FALSE))
+#define gnome_config_private_get_keys(path,keys,n_keys) \
+	(gnome_config_get_keys_((path),(keys),(n_keys),TRUE))
+
+/* Paths parsed once, for keys that are accessed over and over again */
+typedef struct _GnomeConfigPath GnomeConfigPath;
+
+GnomeConfigPath *gnome_config_path_new_ (const char *path, gboolean priv);
+#define gnome_config_path_new(path) \
+	(gnome_config_path_new_((path),FALSE))
+#define gnome_config_private_path_new(path) \
+	(gnome_config_path_new_((path),TRUE))
+void     gnome_config_path_free       (GnomeConfigPath *cpath);
+
+char    *gnome_config_path_get_string (GnomeConfigPath *cpath, gboolean *def);
+gint     gnome_config_path_get_int    (GnomeConfigPath *cpath, gboolean *def);
+gdouble  gnome_config_path_get_float  (GnomeConfigPath *cpath, gboolean *def);
+gboolean gnome_config_path_get_bool   (GnomeConfigPath *cpath, gboolean *def);
+
+void gnome_config_path_set_string (GnomeConfigPath *cpath, const char *value);
+void gnome_config_path_set_int    (GnomeConfigPath *cpath, gint value);
+void gnome_config_path_set_float  (GnomeConfigPath *cpath, gdouble value);
+void gnome_config_path_set_bool   (GnomeConfigPath *cpath, gboolean value);
+
 /* Set a config variable.  Use the warppers below*/
 void gnome_config_set_string_     (const char *path, const char *value,
 				   gboolean priv);
@@ -227,10 +269,57 @@ void *gnome_config_init_iterator_sections_ (const char *path, gboolean priv);
 /* Get next key and value value from a section */
 void *gnome_config_iterator_next (void *iterator_handle, char **key, char **value);
 
+/* Call a function on every key of /file/section, or every section of
+   /file, without copying anything; value is NULL for sections */
+typedef gboolean (*GnomeConfigForeachFunc) (const char *name,
+					    const char *value,
+					    gpointer user_data);
+
+gboolean gnome_config_foreach_ (const char *path, GnomeConfigForeachFunc func,
+				gpointer user_data, gboolean priv);
+#define gnome_config_foreach(path,func,user_data) \
+	(gnome_config_foreach_((path),(func),(user_data),FALSE))
+#define gnome_config_private_foreach(path,func,user_data) \
+	(gnome_config_foreach_((path),(func),(user_data),TRUE))
+
+gboolean gnome_config_foreach_section_ (const char *path,
+					GnomeConfigForeachFunc func,
+					gpointer user_data, gboolean priv);
+#define gnome_config_foreach_section(path,func,user_data) \
+	(gnome_config_foreach_section_((path),(func),(user_data),FALSE))
+#define gnome_config_private_foreach_section(path,func,user_data) \
+	(gnome_config_foreach_section_((path),(func),(user_data),TRUE))
+
 void gnome_config_drop_all       (void);
 
+/* Bounds the number of files (and memory) gnome-config keeps around */
+typedef struct {
+	guint  profiles;	/* files currently in memory */
+	gsize  bytes;		/* approximate memory they use */
+	gulong hits;		/* accesses to files already in memory */
+	gulong misses;		/* accesses that (re)loaded a file */
+	gulong evictions;	/* files dropped to honour the limits */
+} GnomeConfigCacheStats;
+
+void gnome_config_set_cache_limits (guint max_profiles, gsize max_bytes);
+void gnome_config_get_cache_stats  (GnomeConfigCacheStats *stats);
+
+/* Use change notification rather than polling to notice edits on disk */
+gboolean gnome_config_set_watch_changes (gboolean watch);
+
 gboolean gnome_config_sync       (void);
 
+/* Whether syncing drops the files held in memory */
+typedef enum {
+	GNOME_CONFIG_SYNC_DROP,
+	GNOME_CONFIG_SYNC_KEEP
+} GnomeConfigSyncMode;
+
+void gnome_config_set_sync_mode (GnomeConfigSyncMode mode);
+
+/* Write changes out by themselves, interval milliseconds after they're made */
+void gnome_config_set_autosync (guint interval);
+
 /* sync's data for one file only */
 gboolean gnome_config_sync_file_ (char *path, gboolean priv);
 #define gnome_config_sync_file(path) \
@@ -29,6 +29,7 @@
 #include "gnome-util.h"
 #include "gnome-gconfP.h"
 #include "gnome-init.h"
+#include "libgnome-private.h"
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -36,6 +37,13 @@
 #include <sys/types.h>
 #ifndef G_OS_WIN32
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <dirent.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
 #endif
 #include <stdlib.h>
 #include <string.h>
@@ -48,6 +56,19 @@
 extern int errno;
 #endif
 
+#if defined (__NR_close_range) && !defined (CLOSE_RANGE_CLOEXEC)
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+
+#if defined(__APPLE__) && defined(HAVE_NSGETENVIRON) && defined(HAVE_CRT_EXTERNS_H)
+# include <crt_externs.h>
+# define environ (*_NSGetEnviron())
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 #ifndef G_OS_WIN32
 
 static void
@@ -56,6 +77,52 @@ set_cloexec (gint fd)
   fcntl (fd, F_SETFD, FD_CLOEXEC);
 }
 
+/* Marks every open fd from @lowfd up as close-on-exec, or closes them
+ * right away if @on_exec is %FALSE.  Walking up to _SC_OPEN_MAX is only
+ * the last resort, since that can be millions of system calls with a
+ * high ulimit. */
+static void
+close_fds_from (gint lowfd, gboolean on_exec)
+{
+  DIR *dir;
+  int i, open_max;
+
+#ifdef __NR_close_range
+  if (syscall (__NR_close_range, lowfd, ~0U,
+	       on_exec ? CLOSE_RANGE_CLOEXEC : 0) == 0)
+    return;
+#endif
+
+  dir = opendir ("/proc/self/fd");
+  if (dir != NULL)
+    {
+      struct dirent *ent;
+
+      /* the directory's own fd gets marked too, which is harmless */
+      while ((ent = readdir (dir)) != NULL)
+	{
+	  char *end;
+	  long fd = strtol (ent->d_name, &end, 10);
+
+	  if (end == ent->d_name || *end != '\0' || fd < lowfd)
+	    continue;
+	  if (on_exec)
+	    set_cloexec (fd);
+	  else if (fd != dirfd (dir))
+	    close (fd);
+	}
+      closedir (dir);
+      return;
+    }
+
+  open_max = sysconf (_SC_OPEN_MAX);
+  for (i = lowfd; i < open_max; i++)
+    if (on_exec)
+      set_cloexec (i);
+    else
+      close (i);
+}
+
 static ssize_t
 safe_read (int fd, void *buf, size_t count)
 {
@@ -66,8 +133,538 @@ safe_read (int fd, void *buf, size_t count)
   return n;
 }
 
+/*
+ * Sets up what the program about to be executed by a child inherits:
+ * the environment, the directory and, with @close_fds, a /dev/null stdin
+ * and no fds above 2 (except @keep_fd until the exec).  Returns 0, or an
+ * errno if the child should give up.
+ */
+static int
+prepare_child (int keep_fd, const char *dir, int envc, char * const envv[],
+	       gboolean close_fds)
+{
+  int itmp;
+
+  if(envv) {
+    for(itmp = 0; itmp < envc; itmp++)
+      putenv(envv[itmp]);
+  }
+
+  if(dir && chdir(dir))
+    return errno;
+
+  if(close_fds)
+    {
+      int stdinfd;
+      /* Close all file descriptors but stdin stdout and stderr */
+      close_fds_from (3, TRUE);
+
+      if(keep_fd != 0) {
+	close(0);
+	/* Open stdin as being nothingness, so that if someone tries to
+	   read from this they don't hang up the whole GNOME session. BUGFIX #1548 */
+	stdinfd = open("/dev/null", O_RDONLY);
+	g_assert(stdinfd >= 0);
+	if(stdinfd != 0)
+	  {
+	    dup2(stdinfd, 0);
+	    close(stdinfd);
+	  }
+      }
+    }
+  signal (SIGPIPE, SIG_DFL);
+
+  return 0;
+}
+
+/*
+ * Runs in the intermediate process: sets up what the grandchild inherits,
+ * starts it in a new session, then reports its pid on @report_fd,
+ * followed by an errno if it could not be started.  The intermediate
+ * process is a copy of the caller, so where vfork() exists the grandchild
+ * shares its memory instead of copying the page tables a second time,
+ * and reports exec failures through that shared memory.
+ */
+static void
+spawn_grandchild (int report_fd, const char *dir, int argc,
+		  char * const argv[], int envc, char * const envv[],
+		  gboolean close_fds)
+{
+  volatile int child_errno = 0;
+  char **cpargv;
+  pid_t child_pid;
+  int itmp;
+#ifndef HAVE_VFORK
+  int child_comm_pipes[2];
+  gssize res;
+#endif
+
+  set_cloexec (report_fd);
+
+  itmp = prepare_child (report_fd, dir, envc, envv, close_fds);
+  if (itmp != 0) {
+    child_errno = itmp;
+    child_pid = -1;
+    goto report;
+  }
+
+  cpargv = g_alloca((argc + 1) * sizeof(char *));
+  memcpy(cpargv, argv, argc * sizeof(char *));
+  cpargv[argc] = NULL;
+
+#ifdef HAVE_VFORK
+  child_pid = vfork();
+  if (child_pid == 0) {
+    setsid ();
+    execvp(cpargv[0], cpargv);
+    child_errno = errno;
+    _exit(1);
+  } else if (child_pid < 0)
+    child_errno = errno;
+#else
+  if(pipe(child_comm_pipes)) {
+    child_errno = errno;
+    child_pid = -1;
+    goto report;
+  }
+
+  child_pid = fork();
+  switch(child_pid) {
+  case -1:
+    child_errno = errno;
+    close(child_comm_pipes[0]);
+    close(child_comm_pipes[1]);
+    break;
+
+  case 0:
+    close (child_comm_pipes[0]);
+    set_cloexec (child_comm_pipes[1]);
+    setsid ();
+    execvp(cpargv[0], cpargv);
+
+    /* failed */
+    itmp = errno;
+    write(child_comm_pipes[1], &itmp, sizeof(itmp));
+    _exit(1);
+
+  default:
+    close(child_comm_pipes[1]);
+    res = safe_read(child_comm_pipes[0], &itmp, sizeof(itmp));
+    if (res == sizeof(itmp))
+      child_errno = itmp;
+    close(child_comm_pipes[0]);
+    break;
+  }
+#endif
+
+ report:
+  write(report_fd, &child_pid, sizeof(child_pid));
+  if (child_errno != 0) {
+    itmp = child_errno;
+    write(report_fd, &itmp, sizeof(itmp));
+  }
+  _exit(0);
+}
+
+/*
+ * The spawn helper, see gnome_execute_helper_start().  A request is a
+ * HelperRequest, carrying the caller's stdin, stdout and stderr as
+ * SCM_RIGHTS, followed by @len bytes of nul-terminated strings: the
+ * directory, the @argc arguments, the @envc additions to the environment
+ * and the @environc strings of the caller's environment.  The answer is
+ * a HelperReply.
+ */
+typedef struct {
+  gint32 argc, envc, environc;
+  guint32 len;
+} HelperRequest;
+
+typedef struct {
+  gint32 pid;
+  gint32 error;
+} HelperReply;
+
+static GStaticMutex helper_lock = G_STATIC_MUTEX_INIT;
+static int helper_fd = -1;
+static pid_t helper_pid = -1;
+
+static gboolean
+write_all (int fd, const void *buf, gsize count)
+{
+  const char *p = buf;
+
+  while (count > 0)
+    {
+      gssize n = send (fd, p, count, MSG_NOSIGNAL);
+
+      if (n < 0 && errno == EINTR)
+	continue;
+      if (n <= 0)
+	return FALSE;
+      p += n;
+      count -= n;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+read_all (int fd, void *buf, gsize count)
+{
+  char *p = buf;
+
+  while (count > 0)
+    {
+      gssize n = safe_read (fd, p, count);
+
+      if (n <= 0)
+	return FALSE;
+      p += n;
+      count -= n;
+    }
+
+  return TRUE;
+}
+
+/* Reads a request header, and the fds sent with it into @fds, -1 if not */
+static gboolean
+helper_recv_request (int fd, HelperRequest *req, int fds[3])
+{
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE (3 * sizeof (int))];
+  } control;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  gssize n;
+
+  memset (&msg, 0, sizeof (msg));
+  iov.iov_base = req;
+  iov.iov_len = sizeof (*req);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof (control.buf);
+
+  while ((n = recvmsg (fd, &msg, 0)) < 0 && errno == EINTR)
+    ;
+  if (n <= 0)
+    return FALSE;
+
+  fds[0] = fds[1] = fds[2] = -1;
+  for (cmsg = CMSG_FIRSTHDR (&msg); cmsg; cmsg = CMSG_NXTHDR (&msg, cmsg))
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+	cmsg->cmsg_len == CMSG_LEN (3 * sizeof (int)))
+      memcpy (fds, CMSG_DATA (cmsg), 3 * sizeof (int));
+
+  /* the rest of the header, in the unlikely case it was split */
+  return read_all (fd, (char *) req + n, sizeof (*req) - n);
+}
+
+/* Splits @count strings off the front of *@p into a %NULL-terminated
+ * vector, or returns %NULL if there are not that many before @end */
+static char **
+helper_take_strings (char **p, const char *end, gint32 count)
+{
+  char **vec;
+  gint32 i;
+
+  if (count < 0)
+    return NULL;
+
+  vec = g_new (char *, count + 1);
+  for (i = 0; i < count; i++)
+    {
+      char *nul = *p < end ? memchr (*p, '\0', end - *p) : NULL;
+
+      if (nul == NULL)
+	{
+	  g_free (vec);
+	  return NULL;
+	}
+      vec[i] = *p;
+      *p = nul + 1;
+    }
+  vec[count] = NULL;
+
+  return vec;
+}
+
+static void
+helper_main (int fd)
+{
+  extern char **environ;
+
+  for (;;)
+    {
+      HelperRequest req;
+      HelperReply reply;
+      char *body, *p, *end;
+      char **dirv, **argv, **envv, **env, **old_environ;
+      int fds[3], saved[3], i;
+
+      if (!helper_recv_request (fd, &req, fds))
+	_exit (0);
+
+      body = g_malloc (req.len);
+      if (!read_all (fd, body, req.len))
+	_exit (0);
+
+      p = body;
+      end = body + req.len;
+      dirv = helper_take_strings (&p, end, 1);
+      argv = dirv ? helper_take_strings (&p, end, req.argc) : NULL;
+      envv = argv ? helper_take_strings (&p, end, req.envc) : NULL;
+      env = envv ? helper_take_strings (&p, end, req.environc) : NULL;
+
+      if (env == NULL || req.argc < 1 || fds[0] < 0)
+	{
+	  reply.pid = -1;
+	  reply.error = EINVAL;
+	}
+      else
+	{
+	  /* the child inherits the caller's stdin, stdout and stderr,
+	   * and the helper gets its own back for the next launch */
+	  for (i = 0; i < 3; i++)
+	    {
+	      saved[i] = dup (i);
+	      dup2 (fds[i], i);
+	    }
+
+	  old_environ = environ;
+	  environ = env;
+	  reply.pid = gnome_execute_async_with_env_fds (dirv[0], req.argc, argv,
+							req.envc, envv, TRUE);
+	  reply.error = errno;
+	  environ = old_environ;
+
+	  for (i = 0; i < 3; i++)
+	    if (saved[i] >= 0)
+	      {
+		dup2 (saved[i], i);
+		close (saved[i]);
+	      }
+	    else
+	      close (i);
+	}
+
+      for (i = 0; i < 3; i++)
+	if (fds[i] >= 0)
+	  close (fds[i]);
+      g_free (dirv);
+      g_free (argv);
+      g_free (envv);
+      g_free (env);
+      g_free (body);
+
+      if (!write_all (fd, &reply, sizeof (reply)))
+	_exit (0);
+    }
+}
+
+/* Called with helper_lock held, when the helper stopped answering */
+static void
+helper_stop (void)
+{
+  close (helper_fd);
+  helper_fd = -1;
+
+  kill (helper_pid, SIGKILL);
+  while ((waitpid (helper_pid, NULL, 0) == -1) && (errno == EINTR))
+    ; /* eat zombies */
+  helper_pid = -1;
+}
+
+/* Has the helper launch @argv, setting *@handled to %FALSE if there is
+ * no working helper and the caller has to do it */
+static int
+helper_execute (const char *dir, int argc, char * const argv[],
+		int envc, char * const envv[], gboolean *handled)
+{
+  extern char **environ;
+  union {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE (3 * sizeof (int))];
+  } control;
+  int fds[3] = { 0, 1, 2 };
+  HelperRequest req;
+  HelperReply reply;
+  GString *body;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  char *cwd = NULL;
+  gssize n;
+  int i;
+
+  *handled = FALSE;
+
+  if (dir == NULL)
+    dir = cwd = g_get_current_dir ();
+  if (envv == NULL)
+    envc = 0;
+
+  body = g_string_new (NULL);
+  g_string_append_len (body, dir, strlen (dir) + 1);
+  for (i = 0; i < argc; i++)
+    g_string_append_len (body, argv[i], strlen (argv[i]) + 1);
+  for (i = 0; i < envc; i++)
+    g_string_append_len (body, envv[i], strlen (envv[i]) + 1);
+  for (i = 0; environ[i] != NULL; i++)
+    g_string_append_len (body, environ[i], strlen (environ[i]) + 1);
+  g_free (cwd);
+
+  req.argc = argc;
+  req.envc = envc;
+  req.environc = i;
+  req.len = body->len;
+
+  memset (&msg, 0, sizeof (msg));
+  iov.iov_base = &req;
+  iov.iov_len = sizeof (req);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof (control.buf);
+  cmsg = CMSG_FIRSTHDR (&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN (sizeof (fds));
+  memcpy (CMSG_DATA (cmsg), fds, sizeof (fds));
+
+  g_static_mutex_lock (&helper_lock);
+
+  if (helper_fd < 0)
+    {
+      g_static_mutex_unlock (&helper_lock);
+      g_string_free (body, TRUE);
+      return -1;
+    }
+
+  while ((n = sendmsg (helper_fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+    ;
+
+  if (n < 0 && errno == EBADF)
+    {
+      /* stdin, stdout or stderr is closed, which we cannot pass on */
+      g_static_mutex_unlock (&helper_lock);
+      g_string_free (body, TRUE);
+      return -1;
+    }
+
+  if (n != sizeof (req) ||
+      !write_all (helper_fd, body->str, body->len) ||
+      !read_all (helper_fd, &reply, sizeof (reply)))
+    {
+      helper_stop ();
+      g_static_mutex_unlock (&helper_lock);
+      g_string_free (body, TRUE);
+      return -1;
+    }
+
+  g_static_mutex_unlock (&helper_lock);
+  g_string_free (body, TRUE);
+
+  *handled = TRUE;
+  if (reply.pid < 0)
+    errno = reply.error;
+
+  return reply.pid;
+}
+
 #endif
 
+/**
+ * gnome_execute_helper_start:
+ *
+ * Forks a small helper process that the gnome_execute functions use from
+ * then on to launch programs when @close_fds is %TRUE.  Every fork() copies
+ * the page tables of the forking process, so launching from a large process
+ * is slow; the helper stays as small as the process was when it was
+ * started.  The launched programs get the caller's current directory,
+ * environment, stdin, stdout and stderr, like when they are launched
+ * directly.  The helper closes every other fd it inherits.
+ *
+ * Call this as early as possible, before the process has grown.
+ * gnome_program_init() calls it when the
+ * %GNOME_PARAM_SPAWN_HELPER property is set.  If the helper dies,
+ * programs are launched directly again.
+ *
+ * There is no separate call for launching many programs at once: once
+ * the helper runs, every launch goes through it, so a burst of launches
+ * costs one small fork each instead of a fork of the calling process.
+ *
+ * Returns: %TRUE if the helper is running.
+ **/
+gboolean
+gnome_execute_helper_start (void)
+{
+#ifndef G_OS_WIN32
+  int sv[2];
+  pid_t pid;
+
+  g_static_mutex_lock (&helper_lock);
+
+  if (helper_fd >= 0)
+    {
+      g_static_mutex_unlock (&helper_lock);
+      return TRUE;
+    }
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv))
+    {
+      g_static_mutex_unlock (&helper_lock);
+      return FALSE;
+    }
+
+  pid = fork ();
+
+  switch (pid) {
+  case -1:
+    close (sv[0]);
+    close (sv[1]);
+    g_static_mutex_unlock (&helper_lock);
+    return FALSE;
+
+  case 0:
+    /* keep only stdin, stdout, stderr and the socket, on fd 3 */
+    close (sv[0]);
+    if (sv[1] != 3)
+      {
+	dup2 (sv[1], 3);
+	close (sv[1]);
+      }
+    close_fds_from (4, FALSE);
+    helper_main (3);
+    break;
+
+  default:
+    break;
+  }
+
+  close (sv[1]);
+  set_cloexec (sv[0]);
+#ifdef SO_NOSIGPIPE
+  {
+    int on = 1;
+
+    setsockopt (sv[0], SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof (on));
+  }
+#endif
+
+  helper_fd = sv[0];
+  helper_pid = pid;
+
+  g_static_mutex_unlock (&helper_lock);
+
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
 /**
  * gnome_execute_async_with_env_fds:
  * @dir: Directory in which child should be executed, or %NULL for current
@@ -79,7 +676,9 @@ safe_read (int fd, void *buf, size_t count)
  * @close_fds: If %TRUE will close all fds but 0,1, and 2
  * 
  * Description:  Like gnome_execute_async_with_env() but has a flag to
- * decide whether or not to close fd's
+ * decide whether or not to close fd's.  When @close_fds is %TRUE and
+ * gnome_execute_helper_start() was called, the program is launched by
+ * the helper process.
  * 
  * Returns: the process id, or %-1 on error.
  **/
@@ -90,11 +689,17 @@ gnome_execute_async_with_env_fds (const char *dir, int argc,
 				  gboolean close_fds)
 {
 #ifndef G_OS_WIN32
-  int parent_comm_pipes[2], child_comm_pipes[2];
-  int child_errno, itmp, i, open_max;
+  int parent_comm_pipes[2];
+  int child_errno, itmp;
   gssize res;
-  char **cpargv;
   pid_t child_pid, immediate_child_pid;
+  gboolean handled;
+
+  if(close_fds && helper_fd >= 0) {
+    child_pid = helper_execute (dir, argc, argv, envc, envv, &handled);
+    if(handled)
+      return child_pid;
+  }
 
   if(pipe(parent_comm_pipes))
     return -1;
@@ -107,88 +712,10 @@ gnome_execute_async_with_env_fds (const char *dir, int argc,
     close(parent_comm_pipes[1]);
     return -1;
 
-  case 0: /* START PROCESS 1: child */
-    child_pid = -1;
-    res = pipe(child_comm_pipes);
+  case 0: /* START PROCESS 1: child, dies once the grandchild started */
     close(parent_comm_pipes[0]);
-    if(!res)
-      child_pid = fork();
-
-    switch(child_pid) {
-    case -1:
-      itmp = errno;
-      child_pid = -1; /* simplify parent code */
-      write(parent_comm_pipes[1], &child_pid, sizeof(child_pid));
-      write(parent_comm_pipes[1], &itmp, sizeof(itmp));
-      close(child_comm_pipes[0]);
-      close(child_comm_pipes[1]);
-      _exit(0); break;      /* END PROCESS 1: monkey in the middle dies */
-
-    default:
-      {
-	char buf[16];
-	
-	close(child_comm_pipes[1]);
-	while((res = safe_read(child_comm_pipes[0], buf, sizeof(buf))) > 0)
-	  write(parent_comm_pipes[1], buf, res);
-	close(child_comm_pipes[0]);
-	_exit(0); /* END PROCESS 1: monkey in the middle dies */
-      }
-      break;
-
-    case 0:                 /* START PROCESS 2: child of child */
-      close(parent_comm_pipes[1]);
-      /* pre-exec setup */
-      close (child_comm_pipes[0]);
-      set_cloexec (child_comm_pipes[1]);
-      child_pid = getpid();
-      res = write(child_comm_pipes[1], &child_pid, sizeof(child_pid));
-
-      if(envv) {
-	for(itmp = 0; itmp < envc; itmp++)
-	  putenv(envv[itmp]);
-      }
-
-      if(dir) {
-        if(chdir(dir))
-          _exit(-1);  
-      }
-      
-      cpargv = g_alloca((argc + 1) * sizeof(char *));
-      memcpy(cpargv, argv, argc * sizeof(char *));
-      cpargv[argc] = NULL;
-
-      if(close_fds)
-	{
-	  int stdinfd;
-	  /* Close all file descriptors but stdin stdout and stderr */
-	  open_max = sysconf (_SC_OPEN_MAX);
-	  for (i = 3; i < open_max; i++)
-	    set_cloexec (i);
-
-	  if(child_comm_pipes[1] != 0) {
-	    close(0);
-	    /* Open stdin as being nothingness, so that if someone tries to
-	       read from this they don't hang up the whole GNOME session. BUGFIX #1548 */
-	    stdinfd = open("/dev/null", O_RDONLY);
-	    g_assert(stdinfd >= 0);
-	    if(stdinfd != 0)
-	      {
-		dup2(stdinfd, 0);
-		close(stdinfd);
-	      }
-	  }
-	}
-      setsid ();
-      signal (SIGPIPE, SIG_DFL);
-      /* doit */
-      execvp(cpargv[0], cpargv);
-
-      /* failed */
-      itmp = errno;
-      write(child_comm_pipes[1], &itmp, sizeof(itmp));
-      _exit(1); break;      /* END PROCESS 2 */
-    }
+    spawn_grandchild (parent_comm_pipes[1], dir, argc, argv, envc, envv,
+		      close_fds);
     break;
 
   default: /* parent process */
@@ -231,6 +758,244 @@ gnome_execute_async_with_env_fds (const char *dir, int argc,
 #endif
 }
 
+#ifndef G_OS_WIN32
+
+/* Watches a child through a pidfd, which polls readable once the child
+ * exited, so that it can be reaped with wait4() for its rusage */
+typedef struct {
+  GSource source;
+  GPollFD pollfd;
+  pid_t pid;
+  gint64 started;
+} ChildSource;
+
+/* Carries the callback when falling back to a GLib child watch */
+typedef struct {
+  GnomeExecuteExitFunc func;
+  gpointer user_data;
+  gint64 started;
+} ChildWatch;
+
+static gboolean
+child_source_prepare (GSource *source, gint *timeout)
+{
+  *timeout = -1;
+  return FALSE;
+}
+
+static gboolean
+child_source_check (GSource *source)
+{
+  return (((ChildSource *) source)->pollfd.revents & G_IO_IN) != 0;
+}
+
+static gboolean
+child_source_dispatch (GSource *source, GSourceFunc callback,
+		       gpointer user_data)
+{
+  ChildSource *child = (ChildSource *) source;
+  GnomeExecuteChildUsage usage;
+  struct rusage ru;
+  int status;
+  pid_t res;
+
+  while ((res = wait4 (child->pid, &status, WNOHANG, &ru)) == -1 &&
+	 errno == EINTR)
+    ;
+  if (res == 0)
+    return TRUE; /* spurious wakeup */
+
+  if (res == child->pid) {
+    usage.elapsed = _gnome_monotonic_time () - child->started;
+    usage.user_time = (gint64) ru.ru_utime.tv_sec * G_USEC_PER_SEC +
+      ru.ru_utime.tv_usec;
+    usage.system_time = (gint64) ru.ru_stime.tv_sec * G_USEC_PER_SEC +
+      ru.ru_stime.tv_usec;
+    usage.max_rss = ru.ru_maxrss;
+  } else {
+    /* somebody else reaped it, so its status is lost */
+    status = -1;
+    usage.elapsed = usage.user_time = usage.system_time = -1;
+    usage.max_rss = -1;
+  }
+
+  if (callback)
+    ((GnomeExecuteExitFunc) callback) (child->pid, status, &usage,
+				       user_data);
+
+  return FALSE;
+}
+
+static void
+child_source_finalize (GSource *source)
+{
+  close (((ChildSource *) source)->pollfd.fd);
+}
+
+static GSourceFuncs child_source_funcs = {
+  child_source_prepare,
+  child_source_check,
+  child_source_dispatch,
+  child_source_finalize
+};
+
+static void
+child_watch_cb (GPid pid, gint status, gpointer data)
+{
+  ChildWatch *watch = data;
+  GnomeExecuteChildUsage usage;
+
+  usage.elapsed = _gnome_monotonic_time () - watch->started;
+  usage.user_time = usage.system_time = -1;
+  usage.max_rss = -1;
+
+  watch->func (pid, status, &usage, watch->user_data);
+}
+
+static GSource *
+child_source_new (pid_t pid, gint64 started,
+		  GnomeExecuteExitFunc func, gpointer user_data)
+{
+  GSource *source;
+  ChildWatch *watch;
+
+#ifdef __NR_pidfd_open
+  int pidfd = syscall (__NR_pidfd_open, pid, 0);
+
+  if (pidfd >= 0) {
+    ChildSource *child;
+
+    set_cloexec (pidfd);
+
+    source = g_source_new (&child_source_funcs, sizeof (ChildSource));
+    child = (ChildSource *) source;
+    child->pollfd.fd = pidfd;
+    child->pollfd.events = G_IO_IN;
+    child->pid = pid;
+    child->started = started;
+    g_source_add_poll (source, &child->pollfd);
+    g_source_set_callback (source, (GSourceFunc) func, user_data, NULL);
+
+    return source;
+  }
+#endif
+
+  watch = g_new (ChildWatch, 1);
+  watch->func = func;
+  watch->user_data = user_data;
+  watch->started = started;
+
+  source = g_child_watch_source_new (pid);
+  g_source_set_callback (source, (GSourceFunc) child_watch_cb, watch, g_free);
+
+  return source;
+}
+
+#endif
+
+/**
+ * gnome_execute_async_with_watch:
+ * @dir: Directory in which child should be executed, or %NULL for current
+ *       directory
+ * @argc: Number of arguments
+ * @argv: Argument vector to exec child
+ * @envc: Number of environment slots
+ * @envv: Environment vector
+ * @close_fds: If %TRUE will close all fds but 0,1, and 2
+ * @context: The #GMainContext to report the exit in, or %NULL for the
+ *           default one
+ * @func: Called once the child exited
+ * @user_data: Data passed to @func
+ *
+ * Description: Like gnome_execute_async_with_env_fds(), but the child stays
+ * a child of the calling process instead of being detached, and @func is
+ * called from @context with its wait() status and a #GnomeExecuteChildUsage
+ * once it exits.  The child is reaped for you.  Where the system supports
+ * pidfds, the usage includes the CPU time and the peak memory use of the
+ * child; otherwise those are %-1.  If the child was reaped by somebody
+ * else, for instance by a SIGCHLD handler calling waitpid(-1, ...), its
+ * exit status is lost: @func then gets a status of %-1 and every field
+ * of the usage is %-1.
+ *
+ * Returns: the process id, or %-1 on error.
+ **/
+int
+gnome_execute_async_with_watch (const char *dir, int argc,
+				char * const argv[], int envc,
+				char * const envv[], gboolean close_fds,
+				GMainContext *context,
+				GnomeExecuteExitFunc func, gpointer user_data)
+{
+#ifndef G_OS_WIN32
+  int comm_pipes[2];
+  int child_errno, itmp;
+  char **cpargv;
+  gint64 started;
+  GSource *source;
+  pid_t child_pid;
+
+  g_return_val_if_fail (argc > 0, -1);
+  g_return_val_if_fail (argv != NULL, -1);
+  g_return_val_if_fail (func != NULL, -1);
+
+  cpargv = g_alloca((argc + 1) * sizeof(char *));
+  memcpy(cpargv, argv, argc * sizeof(char *));
+  cpargv[argc] = NULL;
+
+  if(pipe(comm_pipes))
+    return -1;
+
+  started = _gnome_monotonic_time ();
+  child_pid = fork();
+
+  switch(child_pid) {
+  case -1:
+    close(comm_pipes[0]);
+    close(comm_pipes[1]);
+    return -1;
+
+  case 0:
+    close(comm_pipes[0]);
+    set_cloexec (comm_pipes[1]);
+    itmp = prepare_child (comm_pipes[1], dir, envc, envv, close_fds);
+    if (itmp == 0) {
+      setsid ();
+      execvp(cpargv[0], cpargv);
+      itmp = errno;
+    }
+    write(comm_pipes[1], &itmp, sizeof(itmp));
+    _exit(1);
+
+  default:
+    break;
+  }
+
+  close(comm_pipes[1]);
+
+  if (safe_read (comm_pipes[0], &child_errno, sizeof(child_errno))
+      == sizeof(child_errno))
+    {
+      close(comm_pipes[0]);
+      while ((waitpid(child_pid, &itmp, 0) == -1) && (errno == EINTR))
+	; /* eat zombies */
+      errno = child_errno;
+      return -1;
+    }
+  close(comm_pipes[0]);
+
+  source = child_source_new (child_pid, started, func, user_data);
+  g_source_attach (source, context);
+  g_source_unref (source);
+
+  return child_pid;
+#else
+  /* FIXME: Implement if needed */
+  g_warning ("gnome_execute_async_with_watch: Not implemented");
+
+  return -1;
+#endif
+}
+
 /**
  * gnome_execute_async_with_env:
  * @dir: Directory in which child should be executed, or NULL for current
@@ -350,62 +1115,38 @@ gnome_execute_shell (const char *dir, const char *commandline)
   return gnome_execute_shell_fds(dir, commandline, TRUE);
 }
 
-/**
- * gnome_prepend_terminal_to_vector:
- * @argc: a pointer to the vector size
- * @argv: a pointer to the vector
- *
- * Description:  Prepends a terminal (either the one configured as default in
- * the user's GNOME setup, or one of the common xterm emulators) to the passed
- * in vector, modifying it in the process.  The vector should be allocated with
- * #g_malloc, as this will #g_free the original vector.  Also all elements must
- * have been allocated separately.  That is the standard glib/GNOME way of
- * doing vectors however.  If the integer that @argc points to is negative, the
- * size will first be computed.  Also note that passing in pointers to a vector
- * that is empty, will just create a new vector for you.
- **/
-void
-gnome_prepend_terminal_to_vector (int *argc, char ***argv)
-{
 #ifndef G_OS_WIN32
-        char **real_argv;
-        int real_argc;
-        int i, j;
-	char **term_argv = NULL;
-	int term_argc = 0;
-	GConfClient *client;
-
-	gchar *terminal = NULL;
 
-	char **the_argv;
-
-        g_return_if_fail (argc != NULL);
-        g_return_if_fail (argv != NULL);
+#define TERMINAL_DIR "/desktop/gnome/applications/terminal"
 
-	/* sanity */
-        if(*argv == NULL)
-                *argc = 0;
+/* The terminal command, forgotten when the TERMINAL_DIR keys change */
+static GStaticMutex terminal_lock = G_STATIC_MUTEX_INIT;
+static char **terminal_argv = NULL;
+static GConfClient *terminal_client = NULL;
 
-	the_argv = *argv;
+static void
+terminal_changed (GConfClient *client, guint cnxn_id,
+		  GConfEntry *entry, gpointer data)
+{
+	g_static_mutex_lock (&terminal_lock);
+	g_strfreev (terminal_argv);
+	terminal_argv = NULL;
+	g_static_mutex_unlock (&terminal_lock);
+}
 
-	/* compute size if not given */
-	if (*argc < 0) {
-		for (i = 0; the_argv[i] != NULL; i++)
-			;
-		*argc = i;
-	}
+static char **
+terminal_argv_resolve (GConfClient *client)
+{
+	char **term_argv = NULL;
+	int term_argc = 0;
+	gchar *terminal;
 
-	/* init our gconf stuff if necessary */
-	gnome_gconf_lazy_init ();
+	terminal = gconf_client_get_string (client, TERMINAL_DIR "/exec", NULL);
 
-	client = gconf_client_get_default ();
-	terminal = gconf_client_get_string (client, "/desktop/gnome/applications/terminal/exec", NULL);
-	g_object_unref (client);
-	
 	if (terminal) {
 		gchar *command_line;
 		gchar *exec_flag;
-		exec_flag = gconf_client_get_string (client, "/desktop/gnome/applications/terminal/exec_arg", NULL);
+		exec_flag = gconf_client_get_string (client, TERMINAL_DIR "/exec_arg", NULL);
 
 		if (exec_flag == NULL)
 			command_line = g_strdup (terminal);
@@ -426,7 +1167,6 @@ gnome_prepend_terminal_to_vector (int *argc, char ***argv)
 	if (term_argv == NULL) {
 		char *check;
 
-		term_argc = 2;
 		term_argv = g_new0 (char *, 3);
 
 		check = g_find_program_in_path ("gnome-terminal");
@@ -456,6 +1196,75 @@ gnome_prepend_terminal_to_vector (int *argc, char ***argv)
 		}
 	}
 
+	return term_argv;
+}
+
+#endif
+
+/**
+ * gnome_prepend_terminal_to_vector:
+ * @argc: a pointer to the vector size
+ * @argv: a pointer to the vector
+ *
+ * Description:  Prepends a terminal (either the one configured as default in
+ * the user's GNOME setup, or one of the common xterm emulators) to the passed
+ * in vector, modifying it in the process.  The vector should be allocated with
+ * #g_malloc, as this will #g_free the original vector.  Also all elements must
+ * have been allocated separately.  That is the standard glib/GNOME way of
+ * doing vectors however.  If the integer that @argc points to is negative, the
+ * size will first be computed.  Also note that passing in pointers to a vector
+ * that is empty, will just create a new vector for you.
+ *
+ * The terminal is looked up once and then remembered until its GConf
+ * settings change.
+ **/
+void
+gnome_prepend_terminal_to_vector (int *argc, char ***argv)
+{
+#ifndef G_OS_WIN32
+        char **real_argv;
+        int real_argc;
+        int i, j;
+	char **term_argv = NULL;
+	int term_argc = 0;
+
+	char **the_argv;
+
+        g_return_if_fail (argc != NULL);
+        g_return_if_fail (argv != NULL);
+
+	/* sanity */
+        if(*argv == NULL)
+                *argc = 0;
+
+	the_argv = *argv;
+
+	/* compute size if not given */
+	if (*argc < 0) {
+		for (i = 0; the_argv[i] != NULL; i++)
+			;
+		*argc = i;
+	}
+
+	g_static_mutex_lock (&terminal_lock);
+	if (terminal_argv == NULL) {
+		if (terminal_client == NULL) {
+			/* init our gconf stuff if necessary, this also
+			 * watches /desktop/gnome for us */
+			gnome_gconf_lazy_init ();
+
+			terminal_client = gconf_client_get_default ();
+			gconf_client_notify_add (terminal_client, TERMINAL_DIR,
+						 terminal_changed,
+						 NULL, NULL, NULL);
+		}
+		terminal_argv = terminal_argv_resolve (terminal_client);
+	}
+	term_argv = g_strdupv (terminal_argv);
+	g_static_mutex_unlock (&terminal_lock);
+
+	term_argc = g_strv_length (term_argv);
+
         real_argc = term_argc + *argc;
         real_argv = g_new (char *, real_argc + 1);
 
@@ -54,6 +54,36 @@ int gnome_execute_async_with_env_fds (const char *dir, int argc,
 				      char * const argv[], int envc,
 				      char * const envv[], gboolean close_fds);
 
+/* What a child launched by gnome_execute_async_with_watch used.  Times are
+   in microseconds and max_rss in kilobytes, -1 where not known.  */
+typedef struct {
+	gint64 elapsed;
+	gint64 user_time;
+	gint64 system_time;
+	glong max_rss;
+} GnomeExecuteChildUsage;
+
+typedef void (*GnomeExecuteExitFunc) (int pid, int status,
+				      const GnomeExecuteChildUsage *usage,
+				      gpointer user_data);
+
+/* Like gnome_execute_async_with_env_fds, but the child is not detached,
+   and FUNC is called from CONTEXT with its exit status once it exits.
+   The status is -1, and so is all of the usage, if somebody else reaped
+   the child first.  */
+int gnome_execute_async_with_watch (const char *dir, int argc,
+				    char * const argv[], int envc,
+				    char * const envv[], gboolean close_fds,
+				    GMainContext *context,
+				    GnomeExecuteExitFunc func,
+				    gpointer user_data);
+
+/* Start a small process that the functions above, except
+   gnome_execute_async_with_watch, use to launch programs so that they do
+   not have to fork the whole calling process.  Bursts of launches go
+   through it one after the other, there is no separate batch call.  */
+gboolean gnome_execute_helper_start (void);
+
 
 
 /* Fork and execute commandline using the user's shell. Calls
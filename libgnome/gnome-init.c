@@ -427,6 +427,7 @@ libgnome_post_args_parse (GnomeProgram *program,
 {
         gboolean enable_sound = TRUE, create_dirs = TRUE;
         char *espeaker = NULL;
+        gint64 start;
 
         g_object_get (program,
                       GNOME_PARAM_CREATE_DIRECTORIES, &create_dirs,
@@ -439,7 +440,9 @@ libgnome_post_args_parse (GnomeProgram *program,
 
         _gnome_sound_set_enabled (enable_sound);
 
+        start = _gnome_trace_start ();
         libgnome_userdir_setup (create_dirs);
+        _gnome_trace_end ("phase", "libgnome_userdir_setup", start);
 }
 
 static void
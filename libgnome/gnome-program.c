@@ -24,8 +24,6 @@
   @NOTATION@
  */
 
-#undef TIME_INIT
-
 #define GNOME_ACCESSIBILITY_ENV "GNOME_ACCESSIBILITY"
 #define GNOME_ACCESSIBILITY_KEY "/desktop/gnome/interface/accessibility"
 
@@ -39,6 +37,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <gmodule.h>
 #include <locale.h>
@@ -52,6 +51,7 @@
 #include "gnome-util.h"
 #include "gnome-init.h"
 #include "gnome-url.h"
+#include "gnome-exec.h"
 
 #include "libgnome-private.h"
 
@@ -87,9 +87,14 @@ struct _GnomeProgramPrivate {
     gboolean prop_create_directories;
     gboolean prop_enable_sound;
     gchar *prop_espeaker;
+    gboolean prop_defer_accessibility;
+    gboolean prop_spawn_helper;
 
     gchar **gnome_path;
 
+    /* results of gnome_program_locate_file(), see locate_cache_lookup() */
+    GHashTable *locate_cache;
+
     /* valid-while: state > APP_CREATE_DONE */
     char *app_id;
     char *app_version;
@@ -103,6 +108,9 @@ struct _GnomeProgramPrivate {
     /* valid-while: state == APP_PREINIT_DONE */
     GArray *top_options_table;
     GSList *accessibility_modules;
+
+    /* the idle source loading the accessibility modules, if deferred */
+    guint accessibility_idle;
 };
 
 enum {
@@ -122,6 +130,8 @@ enum {
     PROP_CREATE_DIRECTORIES,
     PROP_ENABLE_SOUND,
     PROP_ESPEAKER,
+    PROP_DEFER_ACCESSIBILITY,
+    PROP_SPAWN_HELPER,
     PROP_POPT_TABLE,
     PROP_POPT_FLAGS,
     PROP_POPT_CONTEXT,
@@ -142,6 +152,173 @@ static GnomeProgram *global_program = NULL;
 
 static guint last_property_id = PROP_LAST;
 
+/*
+ * Startup tracing.  If GNOME_PROGRAM_TRACE names a file, the init
+ * phases, module loads and module hooks are timed, and written to it in
+ * the Chrome trace event format when the program exits, so that phases
+ * deferred to the main loop are included.
+ */
+typedef struct {
+    const char *category;	/* a string constant */
+    char *name;
+    gint64 start, duration;	/* in microseconds */
+    guint thread;
+} TraceEvent;
+
+static GOnce trace_once = G_ONCE_INIT;
+static GStaticMutex trace_lock = G_STATIC_MUTEX_INIT;
+static char *trace_file = NULL;	/* set once, by trace_init() */
+static GArray *trace_events = NULL;
+static gboolean trace_written = FALSE;
+
+/* threads are numbered from 1 in the order they record their first event */
+static GStaticPrivate trace_thread = G_STATIC_PRIVATE_INIT;
+static guint trace_threads = 0;
+
+static void trace_write (void);
+
+gint64
+_gnome_monotonic_time (void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+#else
+    GTimeVal tv;
+
+    g_get_current_time (&tv);
+    return (gint64) tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec;
+#endif
+}
+
+static gpointer
+trace_init (gpointer data)
+{
+    const char *file = g_getenv ("GNOME_PROGRAM_TRACE");
+
+    if (file != NULL && *file != '\0') {
+	trace_file = g_strdup (file);
+	g_atexit (trace_write);
+    }
+    return trace_file;
+}
+
+/* returns -1 without taking any lock when tracing is off */
+gint64
+_gnome_trace_start (void)
+{
+    if (g_once (&trace_once, trace_init, NULL) == NULL)
+	return -1;
+
+    return _gnome_monotonic_time ();
+}
+
+void
+_gnome_trace_end (const char *category, const char *name, gint64 start)
+{
+    TraceEvent event;
+
+    if (start < 0)
+	return;
+
+    event.category = category;
+    event.start = start;
+    event.duration = _gnome_monotonic_time () - start;
+
+    g_static_mutex_lock (&trace_lock);
+    if (trace_written) {
+	g_static_mutex_unlock (&trace_lock);
+	return;
+    }
+
+    event.thread = GPOINTER_TO_UINT (g_static_private_get (&trace_thread));
+    if (event.thread == 0) {
+	event.thread = ++trace_threads;
+	g_static_private_set (&trace_thread, GUINT_TO_POINTER (event.thread),
+			      NULL);
+    }
+
+    event.name = g_strdup (name ? name : "(unnamed)");
+    if (trace_events == NULL)
+	trace_events = g_array_new (FALSE, FALSE, sizeof (TraceEvent));
+    g_array_append_val (trace_events, event);
+    g_static_mutex_unlock (&trace_lock);
+}
+
+static void
+trace_write_string (FILE *f, const char *s)
+{
+    putc ('"', f);
+    for (; *s; s++) {
+	if (*s == '"' || *s == '\\')
+	    fprintf (f, "\\%c", *s);
+	else if ((guchar) *s < 0x20)
+	    fprintf (f, "\\u%04x", (guchar) *s);
+	else
+	    putc (*s, f);
+    }
+    putc ('"', f);
+}
+
+/* writes the events to the trace file and frees them, at exit */
+static void
+trace_write (void)
+{
+    FILE *f;
+    guint i;
+
+    g_static_mutex_lock (&trace_lock);
+    trace_written = TRUE;
+    if (trace_events == NULL) {
+	g_static_mutex_unlock (&trace_lock);
+	return;
+    }
+
+    f = fopen (trace_file, "w");
+    if (f == NULL)
+	g_warning ("Could not write the startup trace to %s", trace_file);
+    else
+	fprintf (f, "{\"traceEvents\":[\n");
+
+    for (i = 0; i < trace_events->len; i++) {
+	TraceEvent *e = &g_array_index (trace_events, TraceEvent, i);
+
+	if (f != NULL) {
+	    fprintf (f, "%s{\"name\":", i > 0 ? ",\n" : "");
+	    trace_write_string (f, e->name);
+	    fprintf (f, ",\"cat\":\"%s\",\"ph\":\"X\","
+		     "\"ts\":%" G_GINT64_FORMAT ",\"dur\":%" G_GINT64_FORMAT ","
+		     "\"pid\":%d,\"tid\":%u}",
+		     e->category, e->start, e->duration, (int) getpid (),
+		     e->thread);
+	}
+	g_free (e->name);
+    }
+
+    if (f != NULL) {
+	fprintf (f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+	fclose (f);
+    }
+
+    g_array_free (trace_events, TRUE);
+    trace_events = NULL;
+
+    g_static_mutex_unlock (&trace_lock);
+}
+
+/* how long gnome_program_locate_file() trusts what it found, in seconds */
+#define LOCATE_CACHE_TIMEOUT 2
+
+typedef struct {
+    gchar *path;		/* NULL if nothing was found */
+    time_t resolved;
+} LocateEntry;
+
+/* locate_file may be called from any thread, gnome-config does */
+static GStaticMutex locate_lock = G_STATIC_MUTEX_INIT;
+
 #define	PREALLOC_CPARAMS (8)
 #define	PREALLOC_MODINFOS (8)
 
@@ -158,6 +335,67 @@ global_program_unref (void)
     }
 }
 
+static void
+locate_entry_free (gpointer data)
+{
+    LocateEntry *entry = data;
+
+    g_free (entry->path);
+    g_free (entry);
+}
+
+static void
+locate_cache_clear (GnomeProgram *program)
+{
+    g_static_mutex_lock (&locate_lock);
+    if (program->_priv->locate_cache != NULL) {
+	g_hash_table_destroy (program->_priv->locate_cache);
+	program->_priv->locate_cache = NULL;
+    }
+    g_static_mutex_unlock (&locate_lock);
+}
+
+/*
+ * Looks up what gnome_program_locate_file() found for key lately, and
+ * stores a copy of it in result.  Files are only looked for again every
+ * LOCATE_CACHE_TIMEOUT seconds, so a file showing up or going away may
+ * take that long to be noticed.
+ */
+static gboolean
+locate_cache_lookup (GnomeProgram *program, const gchar *key, gchar **result)
+{
+    LocateEntry *entry = NULL;
+
+    g_static_mutex_lock (&locate_lock);
+    if (program->_priv->locate_cache != NULL)
+	entry = g_hash_table_lookup (program->_priv->locate_cache, key);
+    if (entry != NULL && time (NULL) - entry->resolved > LOCATE_CACHE_TIMEOUT)
+	entry = NULL;
+    if (entry != NULL)
+	*result = g_strdup (entry->path);
+    g_static_mutex_unlock (&locate_lock);
+
+    return entry != NULL;
+}
+
+static void
+locate_cache_store (GnomeProgram *program, const gchar *key, const gchar *path)
+{
+    LocateEntry *entry;
+
+    entry = g_new (LocateEntry, 1);
+    entry->path = g_strdup (path);
+    entry->resolved = time (NULL);
+
+    g_static_mutex_lock (&locate_lock);
+    if (program->_priv->locate_cache == NULL)
+	program->_priv->locate_cache =
+	    g_hash_table_new_full (g_str_hash, g_str_equal,
+				   g_free, locate_entry_free);
+    g_hash_table_replace (program->_priv->locate_cache, g_strdup (key), entry);
+    g_static_mutex_unlock (&locate_lock);
+}
+
 static void
 gnome_program_set_property (GObject *object, guint param_id,
 			    const GValue *value, GParamSpec *pspec)
@@ -169,6 +407,9 @@ gnome_program_set_property (GObject *object, guint param_id,
 
     program = GNOME_PROGRAM (object);
 
+    /* the directories files are looked up in may change */
+    locate_cache_clear (program);
+
     switch (param_id) {
     case PROP_GOPTION_CONTEXT:
 	program->_priv->goption_context = g_value_get_pointer (value);
@@ -234,6 +475,12 @@ gnome_program_set_property (GObject *object, guint param_id,
 	g_free (program->_priv->prop_espeaker);
 	program->_priv->prop_espeaker = g_value_dup_string (value);
 	break;
+    case PROP_DEFER_ACCESSIBILITY:
+	program->_priv->prop_defer_accessibility = g_value_get_boolean (value);
+	break;
+    case PROP_SPAWN_HELPER:
+	program->_priv->prop_spawn_helper = g_value_get_boolean (value);
+	break;
     default: {
 	    GObjectSetPropertyFunc set_func;
 
@@ -314,6 +561,12 @@ gnome_program_get_property (GObject *object, guint param_id, GValue *value,
     case PROP_ESPEAKER:
 	g_value_set_string (value, program->_priv->prop_espeaker);
 	break;
+    case PROP_DEFER_ACCESSIBILITY:
+	g_value_set_boolean (value, program->_priv->prop_defer_accessibility);
+	break;
+    case PROP_SPAWN_HELPER:
+	g_value_set_boolean (value, program->_priv->prop_spawn_helper);
+	break;
     default: {
 	    GObjectSetPropertyFunc get_func;
 
@@ -435,6 +688,45 @@ gnome_program_module_list_order (void)
 	    program_modules->len * sizeof(gpointer));
 }
 
+typedef enum {
+    MODULE_PRE_ARGS_PARSE,
+    MODULE_POST_ARGS_PARSE
+} ModuleHookKind;
+
+static GnomeModuleHook
+module_hook (GnomeModuleInfo *module, ModuleHookKind kind)
+{
+    if (kind == MODULE_PRE_ARGS_PARSE)
+	return module->pre_args_parse;
+    else
+	return module->post_args_parse;
+}
+
+static void
+run_module_hook (GnomeProgram *program, GnomeModuleInfo *module,
+		 ModuleHookKind kind)
+{
+    gint64 start = _gnome_trace_start ();
+
+    module_hook (module, kind) (program, module);
+    _gnome_trace_end (kind == MODULE_PRE_ARGS_PARSE ?
+		      "pre_args_parse" : "post_args_parse",
+		      module->name, start);
+}
+
+/* Runs one of the argument parsing hooks of all the modules, in list order */
+static void
+run_module_hooks (GnomeProgram *program, ModuleHookKind kind)
+{
+    GnomeModuleInfo *a_module;
+    int i;
+
+    for (i = 0; (a_module = g_ptr_array_index (program_modules, i)); i++) {
+	if (module_hook (a_module, kind) != NULL)
+	    run_module_hook (program, a_module, kind);
+    }
+}
+
 static void
 gnome_program_class_init (GnomeProgramClass *klass)
 {
@@ -629,6 +921,28 @@ gnome_program_class_init (GnomeProgramClass *klass)
 			      NULL,
 			      (G_PARAM_READABLE | G_PARAM_WRITABLE)));
 
+    g_object_class_install_property
+	(object_class,
+	 PROP_DEFER_ACCESSIBILITY,
+	 g_param_spec_boolean (GNOME_PARAM_DEFER_ACCESSIBILITY,
+			      _("Defer Accessibility"),
+			      _("Load the accessibility modules once the "
+				"main loop runs instead of on startup"),
+			       FALSE,
+			       (G_PARAM_READABLE | G_PARAM_WRITABLE |
+				G_PARAM_CONSTRUCT_ONLY)));
+
+    g_object_class_install_property
+	(object_class,
+	 PROP_SPAWN_HELPER,
+	 g_param_spec_boolean (GNOME_PARAM_SPAWN_HELPER,
+			      _("Spawn Helper"),
+			      _("Launch programs from a helper process "
+				"started before the modules are initialized"),
+			       FALSE,
+			       (G_PARAM_READABLE | G_PARAM_WRITABLE |
+				G_PARAM_CONSTRUCT_ONLY)));
+
     g_type_class_add_private (klass, sizeof (GnomeProgramPrivate));
 }
 
@@ -647,17 +961,10 @@ gnome_program_instance_init (GnomeProgram *program)
 	GnomeModuleInfo *a_module = g_ptr_array_index (program_modules, i);
 
 	if (a_module && a_module->instance_init) {
-#ifdef TIME_INIT
-	    GTimer *timer = g_timer_new ();
-	    g_timer_start (timer);
-	    g_print ("Running class_init for: %s ...", a_module->name);
-#endif
+	    gint64 start = _gnome_trace_start ();
+
 	    a_module->instance_init (program, a_module);
-#ifdef TIME_INIT
-	    g_timer_stop (timer);
-	    g_print ("done (%f seconds)\n", g_timer_elapsed (timer, NULL));
-	    g_timer_destroy (timer);
-#endif
+	    _gnome_trace_end ("instance_init", a_module->name, start);
 	}
     }
 }
@@ -717,8 +1024,14 @@ gnome_program_finalize (GObject* object)
 		g_array_free (self->_priv->top_options_table, TRUE);
 	self->_priv->top_options_table = NULL;
 
+	if (self->_priv->accessibility_idle != 0)
+		g_source_remove (self->_priv->accessibility_idle);
+	self->_priv->accessibility_idle = 0;
+
 	g_slist_free (self->_priv->accessibility_modules);
 
+	locate_cache_clear (self);
+
 	GNOME_CALL_PARENT (G_OBJECT_CLASS, finalize, (object));
 }
 
@@ -893,6 +1206,10 @@ gnome_program_install_property (GnomeProgramClass *pclass,
  * The @ret_locations list and its contents should be freed by the caller, as
  * should the returned string.
  *
+ * When @ret_locations is %NULL, the result is remembered for a couple of
+ * seconds, so a file that is created or removed may not be noticed right
+ * away.
+ *
  * Returns: The full path to the file (if it exists or only_if_exists is
  *          %FALSE) or %NULL.
  */
@@ -903,6 +1220,7 @@ gnome_program_locate_file (GnomeProgram *program, GnomeFileDomain domain,
 {
     gchar *prefix_rel = NULL, *attr_name = NULL, *attr_rel = NULL;
     gchar fnbuf [PATH_MAX], *retval = NULL, **ptr;
+    gchar *cache_key = NULL;
     gboolean search_path = TRUE;
 
     if (program == NULL)
@@ -913,6 +1231,15 @@ gnome_program_locate_file (GnomeProgram *program, GnomeFileDomain domain,
     g_return_val_if_fail (program->_priv->state >= APP_PREINIT_DONE, NULL);
     g_return_val_if_fail (file_name != NULL, NULL);
 
+    if (ret_locations == NULL) {
+	cache_key = g_strdup_printf ("%d:%d:%s", domain,
+				     only_if_exists ? 1 : 0, file_name);
+	if (locate_cache_lookup (program, cache_key, &retval)) {
+	    g_free (cache_key);
+	    return retval;
+	}
+    }
+
 #define ADD_FILENAME(x) { \
 	if (x != NULL) { \
 		if (ret_locations != NULL) \
@@ -998,6 +1325,7 @@ gnome_program_locate_file (GnomeProgram *program, GnomeFileDomain domain,
 	break;
     default:
 	g_warning (G_STRLOC ": unknown file domain %u", domain);
+	g_free (cache_key);
 	return NULL;
     }
 
@@ -1010,6 +1338,7 @@ gnome_program_locate_file (GnomeProgram *program, GnomeFileDomain domain,
 	if (dir == NULL) {
 		g_warning (G_STRLOC ": Directory properties not set correctly.  "
 			   "Cannot locate application specific files.");
+		g_free (cache_key);
 		return NULL;
 	}
 
@@ -1039,6 +1368,10 @@ gnome_program_locate_file (GnomeProgram *program, GnomeFileDomain domain,
 #undef ADD_FILENAME
 
  out:
+    if (ret_locations == NULL) {
+	locate_cache_store (program, cache_key, retval);
+	g_free (cache_key);
+    }
     return retval;
 }
 
@@ -1341,21 +1674,7 @@ gnome_program_preinit (GnomeProgram *program,
     */
 
     /* 3. call the pre-init functions */
-    for (i = 0; (a_module = g_ptr_array_index (program_modules, i)); i++) {
-	if (a_module->pre_args_parse) {
-#ifdef TIME_INIT
-	    GTimer *timer = g_timer_new ();
-	    g_timer_start (timer);
-	    g_print ("Running pre_args_parse for: %s ...", a_module->name);
-#endif
-	    a_module->pre_args_parse (program, a_module);
-#ifdef TIME_INIT
-	    g_timer_stop (timer);
-	    g_print ("done (%f seconds)\n", g_timer_elapsed (timer, NULL));
-	    g_timer_destroy (timer);
-#endif
-	}
-    }
+    run_module_hooks (program, MODULE_PRE_ARGS_PARSE);
 
     if (program->_priv->goption_context) {
         /* 5a. Add the modules' GOptionGroup:s to our context */
@@ -1550,18 +1869,8 @@ found:
   return module_name;
 }
 
-/**
- * gnome_program_module_load:
- * @mod_name: module name
- *
- * Loads a shared library that contains a
- * #GnomeModuleInfo dynamic_module_info structure.
- *
- * Returns: The #GnomeModuleInfo structure that was loaded, or %NULL if the
- * module could not be loaded.
- */
-const GnomeModuleInfo *
-gnome_program_module_load (const char *mod_name)
+static const GnomeModuleInfo *
+module_load (const char *mod_name)
 {
     GModule *mh;
     const GnomeModuleInfo *gmi;
@@ -1594,6 +1903,31 @@ gnome_program_module_load (const char *mod_name)
       }
 }
 
+/**
+ * gnome_program_module_load:
+ * @mod_name: module name
+ *
+ * Loads a shared library that contains a
+ * #GnomeModuleInfo dynamic_module_info structure.
+ *
+ * Returns: The #GnomeModuleInfo structure that was loaded, or %NULL if the
+ * module could not be loaded.
+ */
+const GnomeModuleInfo *
+gnome_program_module_load (const char *mod_name)
+{
+    const GnomeModuleInfo *gmi;
+    gint64 start;
+
+    g_return_val_if_fail (mod_name != NULL, NULL);
+
+    start = _gnome_trace_start ();
+    gmi = module_load (mod_name);
+    _gnome_trace_end ("module_load", mod_name, start);
+
+    return gmi;
+}
+
 /**
  * gnome_program_parse_args:
  * @program: Application object
@@ -1762,6 +2096,44 @@ accessibility_invoke (GnomeProgram *program, gboolean init)
 	return TRUE;
 }
 
+static gboolean
+accessibility_enabled (void)
+{
+	const char *env_var;
+	gboolean do_init;
+
+	if ((env_var = g_getenv (GNOME_ACCESSIBILITY_ENV)))
+		do_init = atoi (env_var);
+	else {
+		GConfClient* gc = gconf_client_get_default ();
+		do_init = gconf_client_get_bool (
+			gc, GNOME_ACCESSIBILITY_KEY, NULL);
+		g_object_unref (gc);
+	}
+
+	return do_init;
+}
+
+/*
+ * Runs at the default idle priority, so after the first windows have
+ * been mapped and drawn.
+ */
+static gboolean
+accessibility_idle (gpointer data)
+{
+	GnomeProgram *program = data;
+	gint64 start = _gnome_trace_start ();
+
+	program->_priv->accessibility_idle = 0;
+
+	if (accessibility_enabled ())
+		accessibility_invoke (program, TRUE);
+
+	_gnome_trace_end ("phase", "accessibility_idle", start);
+
+	return FALSE;
+}
+
 #endif
 
 static void
@@ -1769,8 +2141,6 @@ accessibility_init (GnomeProgram *program)
 {
 #ifndef G_OS_WIN32
 	int i;
-	gboolean do_init;
-	const char *env_var;
 	GSList *list = NULL;
 
 	/* Seek the module list we need */
@@ -1789,18 +2159,12 @@ accessibility_init (GnomeProgram *program)
 
 	program->_priv->accessibility_modules = list;
 
-	do_init = FALSE;
-
-	if ((env_var = g_getenv (GNOME_ACCESSIBILITY_ENV)))
-		do_init = atoi (env_var);
-	else {
-		GConfClient* gc = gconf_client_get_default ();
-		do_init = gconf_client_get_bool (
-			gc, GNOME_ACCESSIBILITY_KEY, NULL);
-		g_object_unref (gc);
-	}
-
-	if (do_init)
+	/* Reading the setting and loading the modules is slow, so
+	 * programs may choose to do it once their main loop runs */
+	if (program->_priv->prop_defer_accessibility)
+		program->_priv->accessibility_idle =
+			g_idle_add (accessibility_idle, program);
+	else if (accessibility_enabled ())
 		accessibility_invoke (program, TRUE);
 #endif
 }
@@ -1815,8 +2179,7 @@ accessibility_init (GnomeProgram *program)
 void
 gnome_program_postinit (GnomeProgram *program)
 {
-    int i;
-    GnomeModuleInfo *a_module;
+    gint64 start;
 
     g_return_if_fail (program != NULL);
     g_return_if_fail (GNOME_IS_PROGRAM (program));
@@ -1825,24 +2188,12 @@ gnome_program_postinit (GnomeProgram *program)
 	return;
 
     /* Call post-parse functions */
-    for (i = 0; (a_module = g_ptr_array_index(program_modules, i)); i++) {
-	if (a_module->post_args_parse) {
-#ifdef TIME_INIT
-	    GTimer *timer = g_timer_new ();
-	    g_timer_start (timer);
-	    g_print ("Running post_args_parse for: %s ...", a_module->name);
-#endif
-	    a_module->post_args_parse (program, a_module);
-#ifdef TIME_INIT
-	    g_timer_stop (timer);
-	    g_print ("done (%f seconds)\n", g_timer_elapsed (timer, NULL));
-	    g_timer_destroy (timer);
-#endif
-	}
-    }
+    run_module_hooks (program, MODULE_POST_ARGS_PARSE);
 
     /* Accessibility magic */
+    start = _gnome_trace_start ();
     accessibility_init (program);
+    _gnome_trace_end ("phase", "accessibility_init", start);
 
     program->_priv->state = APP_POSTINIT_DONE;
 }
@@ -1866,6 +2217,10 @@ gnome_program_postinit (GnomeProgram *program)
  * - to load/save the app's accelerators map from ~/.gnome2/accelerators/$(APPID)
  * - to load/save a GnomeEntry's history from gconf/apps/gnome-settings/$(APPID)/history-$(ENTRYID)
  *
+ * If the GNOME_PROGRAM_TRACE environment variable names a file, the time
+ * spent in every phase of the initialization and in every module is
+ * written to it when the program exits, in the Chrome trace event format.
+ *
  * Returns: A new #GnomeProgram instance representing the current application.
  * Unref the returned reference right before exiting your application.
  */
@@ -1905,13 +2260,8 @@ gnome_program_init_common (GType type,
     GnomeProgram *program;
     GnomeProgramClass *klass;
     int i;
-
-#ifdef TIME_INIT
-    GTimer *global_timer = g_timer_new ();
-
-    g_timer_start (global_timer);
-    g_print ("Starting gnome_program_init:\n\n");
-#endif
+    gint64 init_start = _gnome_trace_start ();
+    gint64 start;
 
     g_type_init ();
 
@@ -1971,17 +2321,9 @@ gnome_program_init_common (GType type,
 	    GnomeModuleInfo *a_module = g_ptr_array_index (program_modules, i);
 
 	    if (a_module && a_module->init_pass) {
-#ifdef TIME_INIT
-	        GTimer *timer = g_timer_new ();
-	        g_timer_start (timer);
-	        g_print ("Running init_pass for: %s ...", a_module->name);
-#endif
+		start = _gnome_trace_start ();
 		a_module->init_pass (a_module);
-#ifdef TIME_INIT
-		g_timer_stop (timer);
-		g_print ("done (%f seconds)\n", g_timer_elapsed (timer, NULL));
-		g_timer_destroy (timer);
-#endif
+		_gnome_trace_end ("init_pass", a_module->name, start);
 	    }
 	}
 
@@ -1992,17 +2334,9 @@ gnome_program_init_common (GType type,
 	    GnomeModuleInfo *a_module = g_ptr_array_index (program_modules, i);
 
 	    if (a_module && a_module->class_init) {
-#ifdef TIME_INIT
-	        GTimer *timer = g_timer_new ();
-	        g_timer_start (timer);
-	        g_print ("Running class_init for: %s ...", a_module->name);
-#endif
+		start = _gnome_trace_start ();
 		a_module->class_init (klass, a_module);
-#ifdef TIME_INIT
-		g_timer_stop (timer);
-		g_print ("done (%f seconds)\n", g_timer_elapsed (timer, NULL));
-		g_timer_destroy (timer);
-#endif
+		_gnome_trace_end ("class_init", a_module->name, start);
 	    }
 	}
     } else if ( ! gnome_program_module_registered (module_info)) {
@@ -2015,17 +2349,9 @@ gnome_program_init_common (GType type,
 	    GnomeModuleInfo *a_module = g_ptr_array_index (program_modules, i);
 
 	    if (a_module && a_module->init_pass) {
-#ifdef TIME_INIT
-	        GTimer *timer = g_timer_new ();
-	        g_timer_start (timer);
-	        g_print ("Running init_pass for: %s ...", a_module->name);
-#endif
+		start = _gnome_trace_start ();
 		a_module->init_pass (a_module);
-#ifdef TIME_INIT
-		g_timer_stop (timer);
-		g_print ("done (%f seconds)\n", g_timer_elapsed (timer, NULL));
-		g_timer_destroy (timer);
-#endif
+		_gnome_trace_end ("init_pass", a_module->name, start);
 	    }
 	}
 
@@ -2037,17 +2363,9 @@ gnome_program_init_common (GType type,
 	    GnomeModuleInfo *a_module = g_ptr_array_index (program_modules, i);
 
 	    if (a_module && a_module->class_init) {
-#ifdef TIME_INIT
-	        GTimer *timer = g_timer_new ();
-	        g_timer_start (timer);
-	        g_print ("Running class_init for: %s ...", a_module->name);
-#endif
+		start = _gnome_trace_start ();
 		a_module->class_init (klass, a_module);
-#ifdef TIME_INIT
-		g_timer_stop (timer);
-		g_print ("done (%f seconds)\n", g_timer_elapsed (timer, NULL));
-		g_timer_destroy (timer);
-#endif
+		_gnome_trace_end ("class_init", a_module->name, start);
 	    }
 	}
     }
@@ -2067,15 +2385,26 @@ gnome_program_init_common (GType type,
 	g_atexit (global_program_unref);
     }
 
+    /* While the process is still small */
+    if (program->_priv->prop_spawn_helper) {
+	start = _gnome_trace_start ();
+	gnome_execute_helper_start ();
+	_gnome_trace_end ("phase", "gnome_execute_helper_start", start);
+    }
+
+    start = _gnome_trace_start ();
     gnome_program_preinit (program, app_id, app_version, argc, argv);
+    _gnome_trace_end ("phase", "gnome_program_preinit", start);
+
+    start = _gnome_trace_start ();
     gnome_program_parse_args (program);
+    _gnome_trace_end ("phase", "gnome_program_parse_args", start);
+
+    start = _gnome_trace_start ();
     gnome_program_postinit (program);
+    _gnome_trace_end ("phase", "gnome_program_postinit", start);
 
-#ifdef TIME_INIT
-    g_timer_stop (global_timer);
-    g_print ("\nGlobal init done in: %f seconds\n\n", g_timer_elapsed (global_timer, NULL));
-    g_timer_destroy (global_timer);
-#endif
+    _gnome_trace_end ("phase", "gnome_program_init", init_start);
 
     return program;
 }
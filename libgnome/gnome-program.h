@@ -116,6 +116,8 @@ gnome_program_locate_file               (GnomeProgram    *program,
 #define GNOME_PARAM_CREATE_DIRECTORIES  "create-directories"
 #define GNOME_PARAM_ENABLE_SOUND        "enable-sound"
 #define GNOME_PARAM_ESPEAKER            "espeaker"
+#define GNOME_PARAM_DEFER_ACCESSIBILITY "defer-accessibility"
+#define GNOME_PARAM_SPAWN_HELPER        "spawn-helper"
 #define GNOME_PARAM_APP_ID              "app-id"
 #define GNOME_PARAM_APP_VERSION         "app-version"
 #define GNOME_PARAM_GNOME_PREFIX        "gnome-prefix"
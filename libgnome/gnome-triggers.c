@@ -54,7 +54,7 @@ typedef void (*GnomeTriggerTypeFunction)(GnomeTrigger *t, char *msg, char *level
 
 /* PROTOTYPES */
 static GnomeTrigger* gnome_trigger_dup(GnomeTrigger *dupme);
-static GnomeTriggerList* gnome_triggerlist_new(char *nodename);
+static GnomeTriggerList* gnome_triggerlist_new(GQuark nodename);
 static void gnome_trigger_do(GnomeTrigger* t, const char *msg, const char *level,
 			     const char *supinfo[]);
 static void gnome_trigger_do_function(GnomeTrigger* t,
@@ -150,14 +150,87 @@ gnome_trigger_dup(GnomeTrigger* dupme)
 }
 
 static GnomeTriggerList*
-gnome_triggerlist_new(char *nodename)
+gnome_triggerlist_new(GQuark nodename)
 {
   GnomeTriggerList* retval;
   retval = g_malloc0(sizeof(GnomeTriggerList));
-  retval->nodename = g_strdup(nodename);
+  retval->nodename = nodename;
   return retval;
 }
 
+static GnomeTriggerList*
+gnome_triggerlist_child(GnomeTriggerList* node, const char *name)
+{
+  GQuark q;
+
+  /* a name that was never interned cannot be a node */
+  if(!node->subtrees || !(q = g_quark_try_string(name)))
+    return NULL;
+
+  return g_hash_table_lookup(node->subtrees, GUINT_TO_POINTER(q));
+}
+
+static void
+gnome_triggerlist_add_unleveled(gpointer key, gpointer value, gpointer data)
+{
+  g_ptr_array_add(value, data);
+}
+
+static void
+gnome_triggerlist_add_action(GnomeTriggerList* node, GnomeTrigger* t)
+{
+  if(!node->actions) {
+    node->actions = g_ptr_array_new();
+    node->unleveled = g_ptr_array_new();
+    node->levels = g_hash_table_new(NULL, NULL);
+  }
+
+  g_ptr_array_add(node->actions, t);
+
+  if(!t->level) {
+    g_ptr_array_add(node->unleveled, t);
+    g_hash_table_foreach(node->levels, gnome_triggerlist_add_unleveled, t);
+  } else {
+    GQuark level = g_quark_from_string(t->level);
+    GPtrArray *bucket;
+    guint i;
+
+    bucket = g_hash_table_lookup(node->levels, GUINT_TO_POINTER(level));
+    if(!bucket) {
+      bucket = g_ptr_array_sized_new(node->unleveled->len + 1);
+      for(i = 0; i < node->unleveled->len; i++)
+	g_ptr_array_add(bucket, g_ptr_array_index(node->unleveled, i));
+      g_hash_table_insert(node->levels, GUINT_TO_POINTER(level), bucket);
+    }
+    g_ptr_array_add(bucket, t);
+  }
+}
+
+/* Runs the triggers of @node that match @level, @level_quark being its
+   quark or 0 if it has none */
+static void
+gnome_triggerlist_do(GnomeTriggerList* node, const char *msg,
+		     const char *level, GQuark level_quark,
+		     const char *supinfo[])
+{
+  GPtrArray *run = NULL;
+  guint i;
+
+  if(!node->actions)
+    return;
+
+  if(!level)
+    run = node->actions;
+  else if(level_quark)
+    run = g_hash_table_lookup(node->levels, GUINT_TO_POINTER(level_quark));
+  if(!run)
+    run = node->unleveled;
+
+  /* by index, as a trigger may add more */
+  for(i = 0; i < run->len; i++)
+    gnome_trigger_do(g_ptr_array_index(run, i), msg, level, supinfo);
+}
+
 /**
  * gnome_triggers_vadd_trigger:
  * @nt: Information on the new trigger to be added.
@@ -170,41 +243,28 @@ gnome_triggerlist_new(char *nodename)
 void gnome_triggers_vadd_trigger(GnomeTrigger* nt,
 				 char *supinfo[])
 {
+  GnomeTriggerList* curnode;
+  int i;
+
   g_return_if_fail(nt != NULL);
   if(!gnome_triggerlist_topnode)
-    gnome_triggerlist_topnode = gnome_triggerlist_new(NULL);
+    gnome_triggerlist_topnode = gnome_triggerlist_new(0);
+
+  for(i = 0, curnode = gnome_triggerlist_topnode;
+      supinfo && supinfo[i]; i++) {
+    GnomeTriggerList* child = gnome_triggerlist_child(curnode, supinfo[i]);
+
+    if(!child) {
+      child = gnome_triggerlist_new(g_quark_from_string(supinfo[i]));
+      if(!curnode->subtrees)
+	curnode->subtrees = g_hash_table_new(NULL, NULL);
+      g_hash_table_insert(curnode->subtrees,
+			  GUINT_TO_POINTER(child->nodename), child);
+    }
+    curnode = child;
+  } /* end for i */
 
-  if(supinfo == NULL || supinfo[0] == NULL) {
-    gnome_triggerlist_topnode->actions = g_realloc(gnome_triggerlist_topnode->actions, ++gnome_triggerlist_topnode->numactions);
-    gnome_triggerlist_topnode->actions[gnome_triggerlist_topnode->numactions - 1] = gnome_trigger_dup(nt);
-  } else {
-    int i, j;
-    GnomeTriggerList* curnode;
-
-    for(i = 0, curnode = gnome_triggerlist_topnode;
-	supinfo[i]; i++) {
-      for(j = 0;
-	  j < curnode->numsubtrees
-	    && strcmp(curnode->subtrees[j]->nodename, supinfo[i]);
-	  j++) /* Do nothing */ ;
-
-      if(j < curnode->numsubtrees) {
-	curnode = curnode->subtrees[j];
-      } else {
-	curnode->subtrees = g_realloc(curnode->subtrees,
-				      ++curnode->numsubtrees
-				      * sizeof(GnomeTriggerList*));
-	curnode->subtrees[curnode->numsubtrees - 1] =
-	  gnome_triggerlist_new(supinfo[i]);
-	curnode = curnode->subtrees[curnode->numsubtrees - 1];
-      } /* end for j */
-    } /* end for i */
-
-    curnode->actions = g_realloc(curnode->actions,
-				 ++curnode->numactions
-				 * sizeof(GnomeTrigger));
-    curnode->actions[curnode->numactions - 1] = gnome_trigger_dup(nt);
-  } /* end if */
+  gnome_triggerlist_add_action(curnode, gnome_trigger_dup(nt));
 }
 
 /**
@@ -291,7 +351,8 @@ void
 gnome_triggers_vdo(const char *msg, const char *level, const char *supinfo[])
 {
   GnomeTriggerList* curnode = gnome_triggerlist_topnode;
-  int i, j;
+  GQuark level_quark;
+  int i;
   char buf[256], *ctmp;
 
   if(level) {
@@ -306,37 +367,15 @@ gnome_triggers_vdo(const char *msg, const char *level, const char *supinfo[])
   gnome_triggers_play_sound(ctmp);
   g_free(ctmp);
 
-  for(i = 0; curnode && supinfo[i]; i++)
-    {
+  level_quark = level ? g_quark_try_string(level) : 0;
 
-    for(j = 0; j < curnode->numactions; j++)
-      {
-	if(!curnode->actions[j]->level
-	   || !level
-	   || !strcmp(level, curnode->actions[j]->level))
-	  gnome_trigger_do(curnode->actions[j], msg, level, supinfo);
-      }
-
-    for(j = 0;
-	j < curnode->numsubtrees
-	  && strcmp(curnode->subtrees[j]->nodename,supinfo[i]);
-	j++)
-      /* Do nothing */ ;
-    if(j < curnode->numsubtrees)
-      curnode = curnode->subtrees[j];
-    else
-      curnode = NULL;
-  }
-  if(curnode)
+  for(i = 0; curnode && supinfo[i]; i++)
     {
-      for(j = 0; j < curnode->numactions; j++)
-	{
-	  if(!curnode->actions[j]->level
-	     || !level
-	     || !strcmp(level, curnode->actions[j]->level))
-	    gnome_trigger_do(curnode->actions[j], msg, level, supinfo);
-	}
+      gnome_triggerlist_do(curnode, msg, level, level_quark, supinfo);
+      curnode = gnome_triggerlist_child(curnode, supinfo[i]);
     }
+  if(curnode)
+    gnome_triggerlist_do(curnode, msg, level, level_quark, supinfo);
 }
 
 static void
@@ -29,12 +29,16 @@
 /* Yes, this mechanism is lame, that's why it's hidden :) */
 typedef struct _GnomeTriggerList GnomeTriggerList;
 
+/* Node names and levels are GQuarks, so that a lookup is one hash */
 struct _GnomeTriggerList {
-  char *nodename;
-  GnomeTriggerList **subtrees;
-  GnomeTrigger **actions;
-  gint numsubtrees;
-  gint numactions;
+  GQuark nodename;
+  GHashTable *subtrees;		/* nodename -> GnomeTriggerList */
+
+  /* NULL until the first trigger is added */
+  GPtrArray *actions;		/* all triggers, in the order they were added */
+  GPtrArray *unleveled;		/* those without a level */
+  GHashTable *levels;		/* level -> GPtrArray of those with that level
+				   or without one, in the order added */
 };
 
 #endif
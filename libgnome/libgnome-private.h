@@ -22,6 +22,21 @@
 
 #include <glib.h>
 
+/* Microseconds from an arbitrary point, monotonic where the system has
+ * clock_gettime() */
+G_GNUC_INTERNAL gint64 _gnome_monotonic_time (void);
+
+/* Startup tracing, see gnome_program_init().  _gnome_trace_start()
+ * returns a timestamp to hand to _gnome_trace_end(), which records an
+ * event lasting from then to now if GNOME_PROGRAM_TRACE is set. */
+G_GNUC_INTERNAL gint64 _gnome_trace_start (void);
+G_GNUC_INTERNAL void _gnome_trace_end (const char *category,
+				       const char *name, gint64 start);
+
+/* Writes the snapshot of the system configuration in dir, see
+ * config-snapshot.cP.  Exported for gnome-config-compile only. */
+gboolean _gnome_config_compile_snapshot (const char *dir, GError **error);
+
 #ifdef G_OS_WIN32
 
 const char *_gnome_get_prefix (void) G_GNUC_CONST;